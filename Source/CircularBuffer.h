@@ -1,7 +1,6 @@
 /*
   ==============================================================================
 
- - need gain (from copyFromWithRamp)?
 
   ==============================================================================
 */
@@ -9,109 +8,681 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "Interpolation.h"
+#include "SampleFormats.h"
+#include "WaveformOverview.h"
+#include "TripleBuffer.h"
 
+//==============================================================================
+// The live input, kept for as long as the buffer is long.
+//
+// Everything sized by the buffer length lives in one Storage, so a new length is a new
+// Storage: requestResize() allocates it on the message thread, and the audio thread
+// then writes each block into both buffers while carrying the existing material over a
+// bounded chunk per block. Once everything still worth keeping has arrived, the new
+// buffer is swapped in between two blocks and the old one handed back to the message
+// thread to free. Voices keep reading the old buffer until then, so a resize never
+// interrupts playback and the audio thread never allocates, frees or copies more than
+// a chunk at a time.
+//
+// Positions handed to voices are in input time (samples written since prepare()), which
+// maps onto whichever buffer is live, so grains carry on across a swap. Voices hold
+// them as 32.32 fixed-point phases (FixedPoint); a buffer whose size is a power of two
+// turns a phase into a buffer index with a mask.
+//
+// Samples can be stored as SampleType or, for long buffers, in a 16-bit format
+// (SampleFormats) at half the memory and bandwidth. Changing the format goes through
+// the same swap as a resize. Compact samples are converted once on the way in, and on
+// the way out a chunk at a time into the reading voice's workspace, where the usual
+// interpolation kernels run on them.
 template <typename SampleType>
 class CircularBuffer
 {
 public:
-    CircularBuffer(int bufferSize)
+    CircularBuffer() = default;
+    
+    ~CircularBuffer()
     {
-        jassert(bufferSize >= 0);
-        
-        mTotalSize = bufferSize > 4 ? bufferSize : 4;
-        mCircularBuffer.get()->setSize(static_cast<int>(mCircularBuffer.get()->getNumChannels()), mTotalSize, false, false, false);
-        mCircularBuffer.get()->clear();
-        mNumSamples = mCircularBuffer.get()->getNumSamples();
+        release();
     }
     
-    ~CircularBuffer() = default;
-    
     //==============================================================================
-    void prepare (const juce::dsp::ProcessSpec& spec)
+    // the longest buffer with numChannels channels, so wide layouts can't ask for
+    // gigabytes; longer sizes are cut down to it
+    static int getMaxBufferSize(int numChannels) noexcept
     {
-        jassert(spec.numChannels > 0);
-        
-        mCircularBuffer.get()->setSize(static_cast<int>(spec.numChannels), mTotalSize, false, false, false);
-        
-        mWritePosition.resize(spec.numChannels);
+        return static_cast<int>(juce::jmin(static_cast<juce::int64>(std::numeric_limits<int>::max() / 2),
+                                           mMaxTotalSamples / juce::jmax(1, numChannels)));
+    }
+    
+    // allocates a buffer of bufferSize samples per channel and drops any resize in
+    // flight; only while the audio thread is stopped
+    void prepare (const juce::dsp::ProcessSpec& spec, int bufferSize, SampleFormats::Format format = SampleFormats::Format::float32)
+    {
+        jassert(spec.numChannels > 0 && bufferSize >= 0);
+    
+        release();
         
-        mSampleRate = spec.sampleRate;
+        mNumChannels = static_cast<int>(spec.numChannels);
+        mRequestedSize = bufferSize;
+        mRequestedFormat = format;
+        mLive.store(new Storage(mNumChannels, bufferSize, format), std::memory_order_release);
         
         reset();
     }
     
+    // frees every buffer; only while the audio thread is stopped. Until the next
+    // prepare(), resize requests are only noted
+    void release()
+    {
+        delete mLive.exchange(nullptr, std::memory_order_acq_rel);
+        delete mPending.exchange(nullptr, std::memory_order_acq_rel);
+        delete mRetired.exchange(nullptr, std::memory_order_acq_rel);
+        delete std::exchange(mTarget, nullptr);
+        
+        mNumChannels = 0;
+        mRequestedSize = 0;
+    }
+    
     //==============================================================================
     void reset()
     {
-        std::fill(mWritePosition.begin(), mWritePosition.end(), 0);
+        mNumWritten = 0;
+        publishWriteHead(0, 0);
         
-        mCircularBuffer.get()->clear();
+        if (auto* live = mLive.load(std::memory_order_acquire))
+            live->clear();
+    }
+    
+    //==============================================================================
+    // Message thread. Starts moving to a buffer of newSize samples per channel stored in
+    // format; returns false if that buffer is already live or on its way. A request the
+    // audio thread hasn't picked up yet is simply replaced. While released (or never
+    // prepared) nothing is allocated: the request is noted, and prepare() sizes the
+    // buffer anyway.
+    bool requestResize(int newSize, SampleFormats::Format format)
+    {
+        releaseRetiredStorage();
+        
+        if (newSize == mRequestedSize && format == mRequestedFormat)
+            return false;
+        
+        if (mNumChannels == 0)
+        {
+            mRequestedSize = newSize;
+            mRequestedFormat = format;
+            return false;
+        }
+        
+        mRequestedSize = newSize;
+        mRequestedFormat = format;
+        delete mPending.exchange(new Storage(mNumChannels, newSize, format), std::memory_order_acq_rel);
+        
+        return true;
+    }
+    
+    // Message thread. Frees the buffer the last resize replaced, once the audio thread
+    // has let go of it; cheap enough to poll from a timer, with hasRetiredStorage().
+    void releaseRetiredStorage()
+    {
+        delete mRetired.exchange(nullptr, std::memory_order_acq_rel);
     }
     
+    bool hasRetiredStorage() const noexcept { return mRetired.load(std::memory_order_acquire) != nullptr; }
+    
     //==============================================================================
+    // audio thread; channels 0 to getNumChannels() - 1 in turn, once per block
     void fillNextBlock(int channel, const int inBufferLength, const SampleType* inBufferData)
     {
-        if (mCircularBuffer.get()->getNumSamples() > inBufferLength + mWritePosition.at(channel))
+        // a resize only starts or ends between blocks, so every channel of a block
+        // lands in the same buffers
+        if (channel == 0)
+            beginPendingResize();
+            
+        write(getLive(), channel, inBufferLength, inBufferData);
+        
+        if (mTarget != nullptr)
         {
-            mCircularBuffer.get()->copyFromWithRamp(channel, mWritePosition.at(channel), inBufferData, inBufferLength, 1, 1);
+            write(*mTarget, channel, inBufferLength, inBufferData);
+            migrateHistory(channel, mNumWritten + inBufferLength);
         }
+        
+        if (channel == mNumChannels - 1)
+            finishBlock(inBufferLength);
+    }
+    
+    //==============================================================================
+    // Copies the newest published overview of the buffer into destination, for drawing
+    // it; an empty one while released. The copy is the caller's, so it outlives any
+    // resize or release. Call from one (non-audio) thread only, the one that calls
+    // releaseRetiredStorage(); it never waits for the audio thread and vice versa, and
+    // only allocates when the buffer's size has changed.
+    void readOverview(WaveformOverview& destination)
+    {
+        if (auto* live = mLive.load(std::memory_order_acquire))
+            destination = live->publishedOverview.read();
         else
+            destination = {};
+    }
+    
+    //==============================================================================
+    // Published after every block, so voices (on any thread) know where the input is.
+    // The newest block covers input times [blockStart, blockStart + blockLength).
+    struct WriteHead
+    {
+        juce::int64 blockStart { 0 };
+        int blockLength { 0 };
+    };
+    
+    // both halves are written before the voices render the block they describe, so a
+    // reader inside that block always sees a matching pair
+    WriteHead getWriteHead() const noexcept
+    {
+        return { mBlockStart.load(std::memory_order_acquire), mBlockLength.load(std::memory_order_acquire) };
+    }
+    
+    // Clamps how far behind the live input (in samples) a read of numSamples at rate
+    // may start, so that it neither overtakes the write head nor falls far enough
+    // behind to be overwritten. The write head can run up to one block ahead of the
+    // reader's "now", which the oldest bound allows for. When a read is too long to
+    // fit either way, not overtaking the head wins.
+    double clampReadDelay(double delay, double rate, int numSamples) const noexcept
+    {
+        const auto length = static_cast<double>(numSamples);
+        const int bufferSize = getBufferSize();
+        const int blockLength = juce::jmin(getWriteHead().blockLength, bufferSize);
+        
+        const double newest = juce::jmax(0.0, (rate - 1.0) * length) + static_cast<double>(mNumGuardAfter);
+        const double oldest = static_cast<double>(bufferSize - blockLength - mNumGuardBefore - 1) - juce::jmax(0.0, (1.0 - rate) * length);
+        
+        return juce::jlimit(newest, juce::jmax(newest, oldest), delay);
+    }
+    
+    // Where a phase in input time lands in the live buffer. A power-of-two size divides
+    // 2^32, so masking the phase is enough; otherwise its full input time is recovered
+    // from how far it lies from the write head, which is never more than a buffer length.
+    FixedPoint::Phase toBufferPhase(FixedPoint::Phase time) const noexcept
+    {
+        const auto& live = getLive();
+        
+        if (live.isPowerOfTwo)
+            return time & live.phaseMask;
+        
+        const auto head = getWriteHead();
+        const auto newest = head.blockStart + head.blockLength;
+        const auto behind = static_cast<juce::int32>(static_cast<juce::uint32>(newest) - FixedPoint::getIndex(time));
+        
+        return FixedPoint::fromFrames(live.indexOf(newest - behind)) | (time & FixedPoint::fractionMask);
+    }
+    
+    //==============================================================================
+    template <typename Interpolator = Interpolation::Linear>
+    SampleType readSample(int channel, FixedPoint::Phase readPhase) const
+    {
+        const auto& live = getLive();
+        const auto index = static_cast<int>(FixedPoint::getIndex(readPhase) % static_cast<juce::uint32>(live.bufferSize));
+        const auto frac = FixedPoint::getFraction<SampleType>(readPhase);
+        
+        return SampleFormats::dispatch<SampleType>(live.format, [&] (auto stored)
         {
-            const int bufferRemaining = mCircularBuffer.get()->getNumSamples() - mWritePosition.at(channel);
+            // the guard samples mirror both ends, so no tap ever needs wrapping
+            const auto* firstTap = live.template getReadPointer<decltype(stored)>(channel) + index - Interpolator::tapsBefore;
+            SampleType taps[Interpolator::numTaps];
             
-            mCircularBuffer.get()->copyFromWithRamp(channel, mWritePosition.at(channel), inBufferData, bufferRemaining, 1, 1);
-            mCircularBuffer.get()->copyFromWithRamp(channel, 0, inBufferData, inBufferLength - bufferRemaining, 1, 1);
-        }
+            SampleFormats::read(taps, firstTap, Interpolator::numTaps);
+            
+            return Interpolator::interpolate(taps + Interpolator::tapsBefore, frac);
+        });
+    }
+    
+    //==============================================================================
+    // Reads numSamples interpolated frames of channels [0, numChannels) into
+    // destinations, starting at readPhase (in the buffer, see toBufferPhase) and
+    // advancing by increment per frame; returns the (wrapped) phase following the last.
+    //
+    // SampleType storage is read in place: the read is split at the wrap point once,
+    // and each contiguous span runs a branch-free inner loop compiled for Interpolator
+    // alone. Indices and interpolation fractions are computed once per frame and shared
+    // by every channel, so a stereo read costs one set of index math, not two. Compact
+    // storage is converted into workspace (the reader's own) a chunk at a time and read
+    // from there the same way.
+    template <typename Interpolator = Interpolation::Linear>
+    FixedPoint::Phase readBlock(SampleType* const* destinations, int numChannels, int numSamples, FixedPoint::Phase readPhase,
+                                FixedPoint::Phase increment, juce::AudioBuffer<SampleType>& workspace) const
+    {
+        jassert(numChannels > 0 && numChannels <= getNumChannels());
+        
+        const auto& live = getLive();
         
-        mWritePosition.at(channel) += inBufferLength;
-        mWritePosition.at(channel) %= mTotalSize;
+        return SampleFormats::dispatch<SampleType>(live.format, [&] (auto stored)
+        {
+            using Stored = decltype(stored);
+        
+            if constexpr (std::is_same_v<Stored, SampleType>)
+                return readInPlace<Interpolator>(live, destinations, numChannels, numSamples, readPhase, increment);
+            else
+                return readConverted<Interpolator, Stored>(live, destinations, numChannels, numSamples, readPhase, increment, workspace);
+        });
     }
     
     //==============================================================================
-    SampleType readSample(int channel, SampleType readPosition)
+    // of the live buffer; a pending resize only shows once it has been swapped in
+    int getBufferSize() const
+    {
+        auto* live = mLive.load(std::memory_order_acquire);
+        return live != nullptr ? live->bufferSize : 0;
+    }
+    
+    SampleFormats::Format getFormat() const
+    {
+        auto* live = mLive.load(std::memory_order_acquire);
+        return live != nullptr ? live->format : SampleFormats::Format::float32;
+    }
+    
+    int getNumChannels() const
     {
-        // look at DelayLine implementation
-        SampleType intpart;
-        readPosFrac = modf(readPosition, &intpart);
-        readPosInt = static_cast<int>(intpart);
+        return mNumChannels;
+    }
+    
+    //==============================================================================
+    const juce::String getName() const { return "CircularBuffer"; };
+    
+private:
+    //==============================================================================
+    // samples before the buffer mirroring its end and after it mirroring its start, so
+    // interpolation taps never wrap (one spare after, to absorb rounding differences in
+    // vectorized position math)
+    static constexpr int mNumGuardBefore { Interpolation::maxTapsBefore };
+    static constexpr int mNumGuardAfter { Interpolation::maxTapsAfter + 1 };
+    
+    // history carried over per channel and block while resizing; bounds what a resize
+    // adds to a block, at about a second to move a minute of 48 kHz audio
+    static constexpr int mMigrationFramesPerBlock { 1 << 15 };
+    
+    // samples across all channels: a gigabyte of float, enough for five minutes of
+    // stereo at 192 kHz even rounded up to a power of two
+    static constexpr juce::int64 mMaxTotalSamples { juce::int64 { 1 } << 28 };
+    
+    //==============================================================================
+    // everything whose size depends on the buffer length; allocated and freed on the
+    // message thread only
+    struct Storage
+    {
+        Storage(int numChannelsToUse, int requestedSize, SampleFormats::Format formatToUse)
+            : numChannels(numChannelsToUse),
+              // every guard sample must mirror a distinct buffer sample
+              bufferSize(juce::jmax(juce::jmin(requestedSize, getMaxBufferSize(numChannelsToUse)), 4, mNumGuardBefore, mNumGuardAfter)),
+              format(formatToUse),
+              isPowerOfTwo(juce::isPowerOfTwo(bufferSize)),
+              phaseMask(FixedPoint::fromFrames(bufferSize) - 1)
+        {
+            jassert(requestedSize <= getMaxBufferSize(numChannels));
+            
+            // only the vector for this format is ever allocated; sizes and offsets across
+            // channels can pass 2^31 samples, so they are worked out in size_t
+            SampleFormats::dispatch<SampleType>(format, [&] (auto stored)
+            {
+                getSamples<decltype(stored)>().resize(static_cast<size_t>(numChannels) * getChannelStride());
+            });
+            
+            overview.prepare(numChannels, bufferSize);
+            publishedOverview.forEachBuffer([&] (WaveformOverview& copy) { copy.prepare(numChannels, bufferSize); });
+        }
         
-        int index1 = readPosInt;
-        int index2 = readPosInt + 1;
+        void clear()
+        {
+            std::fill(floatSamples.begin(), floatSamples.end(), SampleType {});
+            std::fill(int16Samples.begin(), int16Samples.end(), SampleFormats::Int16 {});
+            std::fill(halfSamples.begin(), halfSamples.end(), SampleFormats::Half {});
+            overview.clear();
+        }
+        
+        // the first buffer sample, with mNumGuardBefore samples of history in front of
+        // it; Stored must be the type of format
+        template <typename Stored>
+        Stored* getWritePointer(int channel) { return getSamples<Stored>().data() + static_cast<size_t>(channel) * getChannelStride() + mNumGuardBefore; }
+        
+        template <typename Stored>
+        const Stored* getReadPointer(int channel) const { return const_cast<Storage*>(this)->template getWritePointer<Stored>(channel); }
+        
+        template <typename Stored>
+        std::vector<Stored>& getSamples()
+        {
+            if constexpr (std::is_same_v<Stored, SampleFormats::Int16>)
+                return int16Samples;
+            else if constexpr (std::is_same_v<Stored, SampleFormats::Half>)
+                return halfSamples;
+            else
+                return floatSamples;
+        }
+        
+        size_t getChannelStride() const noexcept { return static_cast<size_t>(mNumGuardBefore + bufferSize + mNumGuardAfter); }
         
-        if (index2 >= mTotalSize)
+        // where input time lands in this buffer
+        int indexOf(juce::int64 time) const noexcept
         {
-            index1 %= mTotalSize;
-            index2 %= mTotalSize;
+            if (isPowerOfTwo)
+                return static_cast<int>(time & (bufferSize - 1));
+            
+            const auto index = static_cast<int>(time % bufferSize);
+            return index < 0 ? index + bufferSize : index;
         }
         
-        SampleType value1 = mCircularBuffer.get()->getSample(channel, index1);
-        SampleType value2 = mCircularBuffer.get()->getSample(channel, index2);
+        const int numChannels;
+        const int bufferSize;
+        const SampleFormats::Format format;
+        
+        // a power-of-two size wraps input time and phases with masks
+        const bool isPowerOfTwo;
+        const FixedPoint::Phase phaseMask;
+        
+        std::vector<SampleType> floatSamples;
+        std::vector<SampleFormats::Int16> int16Samples;
+        std::vector<SampleFormats::Half> halfSamples;
+        
+        // kept current by every write; readers get copies through the triple buffer
+        WaveformOverview overview;
+        TripleBuffer<WaveformOverview> publishedOverview;
+    };
+    
+    //==============================================================================
+    // audio thread, and voices rendering the current block
+    Storage& getLive() const noexcept
+    {
+        return *mLive.load(std::memory_order_acquire);
+    }
+    
+    void write(Storage& storage, int channel, int inBufferLength, const SampleType* inBufferData)
+    {
+        SampleFormats::dispatch<SampleType>(storage.format, [&] (auto stored)
+        {
+            write<decltype(stored)>(storage, channel, inBufferLength, inBufferData);
+        });
+    }
+    
+    template <typename Stored>
+    void write(Storage& storage, int channel, int inBufferLength, const SampleType* inBufferData)
+    {
+        auto* data = storage.template getWritePointer<Stored>(channel);
+        const int bufferSize = storage.bufferSize;
+        
+        // a block longer than the whole buffer only leaves its newest samples behind
+        const int numToWrite = juce::jmin(inBufferLength, bufferSize);
+        const int writeStart = storage.indexOf(mNumWritten + inBufferLength - numToWrite);
+        const SampleType* source = inBufferData + (inBufferLength - numToWrite);
+        
+        // plain copies (or conversions), split once at the wrap point
+        const int firstPart = juce::jmin(numToWrite, bufferSize - writeStart);
+        
+        SampleFormats::write(data + writeStart, source, firstPart);
         
-        // add difference between samples scaled by position between them
-        return value1 + (readPosFrac * (value2 - value1));
+        if (firstPart < numToWrite)
+            SampleFormats::write(data, source + firstPart, numToWrite - firstPart);
+        
+        updateGuardSamples<Stored>(storage, channel);
+        
+        // the new samples are folded into the write head's bucket; nothing is rescanned
+        storage.overview.append(channel, data, writeStart, firstPart);
+        storage.overview.append(channel, data, 0, numToWrite - firstPart);
+    }
+    
+    void finishBlock(int blockLength) noexcept
+    {
+        const auto blockStart = mNumWritten;
+        mNumWritten += blockLength;
+        
+        if (mTarget != nullptr && mNumMigrated >= mNumHistory)
+            completeResize();
+        
+        publishWriteHead(blockStart, blockLength);
+        publishOverview(getLive());
     }
     
     //==============================================================================
-    int getBufferSize()
+    void beginPendingResize() noexcept
+    {
+        // one resize at a time, and only once the last one's old buffer has been freed,
+        // so there is always somewhere to hand the next one back
+        if (mTarget != nullptr || hasRetiredStorage())
+            return;
+        
+        auto* target = mPending.exchange(nullptr, std::memory_order_acq_rel);
+        
+        if (target == nullptr)
+            return;
+        
+        jassert(target->numChannels == mNumChannels);
+        
+        mTarget = target;
+        mMigrationStart = mNumWritten;
+        mNumHistory = static_cast<int>(juce::jmin(static_cast<juce::int64>(juce::jmin(getLive().bufferSize, target->bufferSize)), mNumWritten));
+        mNumMigrated = 0;
+    }
+    
+    // Copies the next chunk of history into the target. History frame j is the input
+    // written at mMigrationStart - mNumHistory + j; new input overwrites the oldest
+    // history in both buffers as it arrives, so whatever it has already reached in
+    // either one is skipped. The chunk outruns any block size, so little is.
+    void migrateHistory(int channel, juce::int64 numWrittenAfterBlock) noexcept
     {
-        return mCircularBuffer.get()->getNumSamples();
+        const auto numWrittenSince = numWrittenAfterBlock - mMigrationStart;
+        const auto lostInTarget = mNumHistory + numWrittenSince - mTarget->bufferSize;
+        const auto lostInLive = numWrittenSince - (getLive().bufferSize - mNumHistory);
+        
+        const auto first = static_cast<int>(juce::jmin(static_cast<juce::int64>(mNumHistory),
+                                                       juce::jmax(static_cast<juce::int64>(mNumMigrated), lostInTarget, lostInLive)));
+        const int last = juce::jmin(mNumHistory, first + mMigrationFramesPerBlock);
+        
+        copyHistory(getLive(), *mTarget, channel, mMigrationStart - mNumHistory + first, last - first);
+        
+        if (channel == mNumChannels - 1)
+            mNumMigrated = last;
+    }
+    
+    // copies input times [startTime, startTime + numFrames) of one channel between two
+    // buffers, split wherever either of them wraps
+    void copyHistory(const Storage& from, Storage& to, int channel, juce::int64 startTime, int numFrames) noexcept
+    {
+        if (numFrames <= 0)
+            return;
+        
+        SampleFormats::dispatch<SampleType>(from.format, [&] (auto storedFrom)
+        {
+            SampleFormats::dispatch<SampleType>(to.format, [&] (auto storedTo)
+            {
+                copyHistory<decltype(storedFrom), decltype(storedTo)>(from, to, channel, startTime, numFrames);
+            });
+        });
+    }
+    
+    template <typename From, typename To>
+    void copyHistory(const Storage& from, Storage& to, int channel, juce::int64 startTime, int numFrames) noexcept
+    {
+        // a format change goes through SampleType, a stack-sized run at a time
+        constexpr int maxRun { 256 };
+        SampleType converted[maxRun];
+        
+        auto* destination = to.template getWritePointer<To>(channel);
+        
+        for (auto time = startTime; numFrames > 0;)
+        {
+            const int fromIndex = from.indexOf(time);
+            const int toIndex = to.indexOf(time);
+            int span = juce::jmin(numFrames, from.bufferSize - fromIndex, to.bufferSize - toIndex);
+            
+            if constexpr (std::is_same_v<From, To>)
+            {
+                std::copy_n(from.template getReadPointer<From>(channel) + fromIndex, span, destination + toIndex);
+            }
+            else
+            {
+                span = juce::jmin(span, maxRun);
+                SampleFormats::read(converted, from.template getReadPointer<From>(channel) + fromIndex, span);
+                SampleFormats::write(destination + toIndex, converted, span);
+            }
+            
+            to.overview.update(channel, destination, toIndex, span);
+            
+            time += span;
+            numFrames -= span;
+        }
+        
+        updateGuardSamples<To>(to, channel);
+    }
+    
+    void completeResize() noexcept
+    {
+        // voices read the new buffer from the next block on; the old one waits for the
+        // message thread, since freeing it here could block
+        auto* previous = mLive.exchange(std::exchange(mTarget, nullptr), std::memory_order_acq_rel);
+        mRetired.store(previous, std::memory_order_release);
     }
     
     //==============================================================================
-    const juce::String getName() const { return "CircularBuffer"; };
+    template <typename Interpolator>
+    FixedPoint::Phase readInPlace(const Storage& live, SampleType* const* destinations, int numChannels, int numSamples,
+                                  FixedPoint::Phase readPhase, FixedPoint::Phase increment) const
+    {
+        if (numChannels == 2)
+        {
+            const SampleType* data[] { live.template getReadPointer<SampleType>(0), live.template getReadPointer<SampleType>(1) };
+            return readFrames<Interpolator, 2>(live, data, destinations, numSamples, readPhase, increment);
+        }
+        
+        // mono, or wider than anything the input bus delivers today
+        auto nextReadPhase = readPhase;
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            const SampleType* data[] { live.template getReadPointer<SampleType>(channel) };
+            nextReadPhase = readFrames<Interpolator, 1>(live, data, destinations + channel, numSamples, readPhase, increment);
+        }
+        
+        return nextReadPhase;
+    }
+    
+    template <typename Interpolator, typename Stored>
+    FixedPoint::Phase readConverted(const Storage& live, SampleType* const* destinations, int numChannels, int numSamples,
+                                    FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<SampleType>& workspace) const
+    {
+        const auto end = Interpolation::readThroughWorkspace<Interpolator>(destinations, numChannels, numSamples, readPhase, increment, workspace,
+                                                                           [&] (juce::int64 firstFrame, int numFrames)
+                                                                           {
+                                                                               for (int channel = 0; channel < numChannels; ++channel)
+                                                                                   convertFrames<Stored>(live, channel, firstFrame, numFrames, workspace.getWritePointer(channel));
+                                                                           });
+        
+        return live.isPowerOfTwo ? (end & live.phaseMask) : end % FixedPoint::fromFrames(live.bufferSize);
+    }
+    
+    // converts buffer frames [firstFrame, firstFrame + numFrames) of one channel, which
+    // may run off either end of the buffer, into destination
+    template <typename Stored>
+    static void convertFrames(const Storage& live, int channel, juce::int64 firstFrame, int numFrames, SampleType* destination) noexcept
+    {
+        const auto* source = live.template getReadPointer<Stored>(channel);
+        
+        for (auto frame = firstFrame; numFrames > 0;)
+        {
+            const int index = live.indexOf(frame);
+            const int span = juce::jmin(numFrames, live.bufferSize - index);
+            
+            SampleFormats::read(destination, source + index, span);
+            
+            destination += span;
+            frame += span;
+            numFrames -= span;
+        }
+    }
+    
+    // Splits the read at the wrap point and hands each contiguous span to
+    // Interpolation::readSpan. Phases are exact, so a span is simply the frames whose
+    // phase stays below the end of the buffer (the guard samples cover the taps past it)
+    template <typename Interpolator, int numChannels>
+    FixedPoint::Phase readFrames(const Storage& live, const SampleType* const* data, SampleType* const* destinations, int numSamples,
+                                 FixedPoint::Phase readPhase, FixedPoint::Phase increment) const
+    {
+        static_assert(Interpolator::tapsBefore <= mNumGuardBefore && Interpolator::tapsAfter < mNumGuardAfter,
+                      "the guard samples must cover every interpolation tap");
+        
+        const auto end = FixedPoint::fromFrames(live.bufferSize);
+        jassert(readPhase < end);
+        
+        int offset = 0;
+        
+        while (offset < numSamples)
+        {
+            auto span = static_cast<FixedPoint::Phase>(numSamples - offset);
+            
+            if (increment > 0)
+                span = juce::jmin(span, (end - readPhase + increment - 1) / increment);
+            
+            Interpolation::readSpan<Interpolator, numChannels>(data, destinations, offset, static_cast<int>(span), readPhase, increment);
+            
+            readPhase += increment * span;
+            offset += static_cast<int>(span);
+            
+            if (readPhase >= end)
+                readPhase = live.isPowerOfTwo ? (readPhase & live.phaseMask) : readPhase % end;
+        }
+        
+        return readPhase;
+    }
+    
+    void publishWriteHead(juce::int64 blockStart, int blockLength) noexcept
+    {
+        mBlockStart.store(blockStart, std::memory_order_release);
+        mBlockLength.store(blockLength, std::memory_order_release);
+    }
+    
+    // copies the overview for the reader, but only once it has taken the previous copy,
+    // so with no editor open this costs nothing
+    void publishOverview(Storage& storage) noexcept
+    {
+        if (storage.publishedOverview.isPublishPending())
+            return;
+        
+        auto& overview = storage.publishedOverview.getWriteBuffer();
+        overview.copyFrom(storage.overview);
+        overview.setWritePosition(storage.indexOf(mNumWritten));
+        
+        storage.publishedOverview.publish();
+    }
+    
+    template <typename Stored>
+    static void updateGuardSamples(Storage& storage, int channel)
+    {
+        auto* data = storage.template getWritePointer<Stored>(channel);
+        
+        for (int i = 0; i < mNumGuardAfter; ++i)
+            data[storage.bufferSize + i] = data[i];
+        
+        for (int i = 1; i <= mNumGuardBefore; ++i)
+            data[-i] = data[storage.bufferSize - i];
+    }
     
     //==============================================================================
-    std::shared_ptr<juce::AudioBuffer<SampleType>> getReferencedBuffer() { return mCircularBuffer; }
+    // live: written by the audio thread, read by voices and (for the overview) the
+    // message thread. pending: handed from the message thread to the audio thread.
+    // retired: handed back once replaced. target: the audio thread's, while it fills up.
+    std::atomic<Storage*> mLive { nullptr };
+    std::atomic<Storage*> mPending { nullptr };
+    std::atomic<Storage*> mRetired { nullptr };
+    Storage* mTarget { nullptr };
     
-private:
-    std::shared_ptr<juce::AudioBuffer<SampleType>> mCircularBuffer = std::make_shared<juce::AudioBuffer<SampleType>>();
+    int mRequestedSize { 0 };
+    SampleFormats::Format mRequestedFormat { SampleFormats::Format::float32 };
+    int mNumChannels { 0 };
+    
+    // samples written since prepare(); input time
+    juce::int64 mNumWritten { 0 };
     
-    std::vector<int> mWritePosition { 0, 0 };
-    int mSampleRate { 44100 };
+    juce::int64 mMigrationStart { 0 };
+    int mNumHistory { 0 };
+    int mNumMigrated { 0 };
     
-    int mNumSamples { 0 };
-    int mTotalSize { 0 };
+    std::atomic<juce::int64> mBlockStart { 0 };
+    std::atomic<int> mBlockLength { 0 };
     
-    SampleType readPosFrac { 0 };
-    int readPosInt { 0 };
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CircularBuffer)
 };
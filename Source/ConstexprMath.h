@@ -0,0 +1,57 @@
+#pragma once
+
+//==============================================================================
+// The few transcendental functions the compile-time tables need; std::sin and
+// std::exp are not constexpr. Accurate to double precision over the ranges the
+// tables use, and only ever evaluated by the compiler.
+namespace ConstexprMath
+{
+    constexpr double pi { 3.14159265358979323846 };
+    
+    constexpr double sine(double x)
+    {
+        // reduce to [-pi, pi], then a Taylor series
+        const double turns = x / (2.0 * pi);
+        const auto nearest = static_cast<long long>(turns < 0.0 ? turns - 0.5 : turns + 0.5);
+        x -= 2.0 * pi * static_cast<double>(nearest);
+        
+        double term = x;
+        double sum = x;
+        
+        for (int n = 1; n < 16; ++n)
+        {
+            term *= -x * x / static_cast<double>((2 * n) * (2 * n + 1));
+            sum += term;
+        }
+        
+        return sum;
+    }
+    
+    constexpr double cosine(double x) { return sine(x + 0.5 * pi); }
+    
+    constexpr double exponential(double x)
+    {
+        // halve until the series converges quickly, then square back up
+        int halvings = 0;
+        
+        while (x > 0.5 || x < -0.5)
+        {
+            x *= 0.5;
+            ++halvings;
+        }
+        
+        double term = 1.0;
+        double sum = 1.0;
+        
+        for (int n = 1; n < 16; ++n)
+        {
+            term *= x / static_cast<double>(n);
+            sum += term;
+        }
+        
+        for (int i = 0; i < halvings; ++i)
+            sum *= sum;
+        
+        return sum;
+    }
+}
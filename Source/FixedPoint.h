@@ -0,0 +1,49 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+// 32.32 fixed-point positions for grain playheads. Phases advance by exact integer
+// adds, so a grain's pitch never drifts however long it plays, and the integer index
+// and interpolation fraction fall out of a shift and a mask. The integer part wraps
+// modulo 2^32 frames: a buffer whose size is a power of two can wrap a phase with a
+// mask alone, and sources that need the true frame resolve it against a reference
+// frame they know to be near (see CircularBuffer::toBufferPhase).
+namespace FixedPoint
+{
+    using Phase = juce::uint64;
+    
+    constexpr int fractionBits { 32 };
+    constexpr Phase one { Phase { 1 } << fractionBits };
+    constexpr Phase fractionMask { one - 1 };
+    
+    constexpr Phase fromFrames(juce::int64 frames) noexcept
+    {
+        return static_cast<Phase>(frames) << fractionBits;
+    }
+    
+    inline Phase fromDouble(double frames) noexcept
+    {
+        const double whole = std::floor(frames);
+        return fromFrames(static_cast<juce::int64>(whole)) + static_cast<Phase>((frames - whole) * static_cast<double>(one));
+    }
+    
+    constexpr juce::uint32 getIndex(Phase phase) noexcept
+    {
+        return static_cast<juce::uint32>(phase >> fractionBits);
+    }
+    
+    // the top 31 bits of the fraction, which convert from a signed int (the conversion
+    // CPUs vectorize) and are more than float or double interpolation can use
+    template <typename SampleType>
+    SampleType getFraction(Phase phase) noexcept
+    {
+        const auto top = static_cast<juce::int32>(static_cast<juce::uint32>(phase) >> 1);
+        return static_cast<SampleType>(top) * static_cast<SampleType>(1.0 / 2147483648.0);
+    }
+    
+    inline double toDouble(Phase phase) noexcept
+    {
+        return static_cast<double>(getIndex(phase)) + static_cast<double>(phase & fractionMask) / static_cast<double>(one);
+    }
+}
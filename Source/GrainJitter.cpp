@@ -0,0 +1,75 @@
+#include "GrainJitter.h"
+
+namespace
+{
+    // conversions from signed ints, which CPUs vectorize
+    inline float toUnit(juce::uint32 bits) noexcept
+    {
+        return static_cast<float>(static_cast<juce::int32>(bits >> 8)) * (1.0f / 16777216.0f);
+    }
+    
+    inline float toBipolar(juce::uint32 bits) noexcept
+    {
+        return static_cast<float>(static_cast<juce::int32>(bits)) * (1.0f / 2147483648.0f);
+    }
+}
+
+//==============================================================================
+GrainJitter::GrainJitter()
+{
+    setSeed(juce::Random::getSystemRandom().nextInt64());
+}
+
+void GrainJitter::prepare(int maxGrainsPerBatch)
+{
+    const auto size = static_cast<size_t>(juce::jmax(1, maxGrainsPerBatch));
+    
+    mBase.assign(size, 0);
+    mSpray.assign(size, 0.0f);
+    mPan.assign(size, 0.0f);
+    mPitch.assign(size, 0.0f);
+    
+    // the next draw fills a batch from the same grain on
+    mCounter += static_cast<juce::uint32>(mNext);
+    mNext = 0;
+    mNumFilled = 0;
+}
+
+void GrainJitter::setSeed(juce::int64 seed) noexcept
+{
+    const auto bits = static_cast<juce::uint64>(seed);
+    
+    mKey = hash(static_cast<juce::uint32>(bits) ^ hash(static_cast<juce::uint32>(bits >> 32)));
+    mCounter = 0;
+    mNext = 0;
+    mNumFilled = 0;
+}
+
+void GrainJitter::fill(int numGrains) noexcept
+{
+    mCounter += static_cast<juce::uint32>(mNext);
+    mNext = 0;
+    mNumFilled = juce::jlimit(0, static_cast<int>(mBase.size()), numGrains);
+    
+    const auto counter = mCounter;
+    const auto key = mKey;
+    auto* base = mBase.data();
+    
+    // hashing the counter before mixing in the key keeps different seeds from being
+    // shifted copies of each other
+    for (int i = 0; i < mNumFilled; ++i)
+        base[i] = hash(hash(counter + static_cast<juce::uint32>(i)) ^ key);
+    
+    auto* spray = mSpray.data();
+    auto* pan = mPan.data();
+    auto* pitch = mPitch.data();
+    
+    for (int i = 0; i < mNumFilled; ++i)
+        spray[i] = toUnit(hash(base[i] ^ mStreamKeys[0]));
+    
+    for (int i = 0; i < mNumFilled; ++i)
+        pan[i] = toBipolar(hash(base[i] ^ mStreamKeys[1]));
+    
+    for (int i = 0; i < mNumFilled; ++i)
+        pitch[i] = toBipolar(hash(base[i] ^ mStreamKeys[2]));
+}
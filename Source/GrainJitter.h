@@ -0,0 +1,79 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+// Random spray, pan and pitch offsets for a voice's grains, drawn in batches.
+//
+// The generator is counter-based: grain n's values are a hash of the seed and n, with
+// nothing carried from one grain to the next. fill() works out a whole segment's
+// grains up front in plain loops that compilers vectorize, and the scheduler only
+// reads them back. Because a value depends only on the grain's index, a batch that was
+// filled too far is simply recomputed by the next one: grain n gets the same offsets
+// however the blocks fall.
+//
+// One per voice, audio thread only (setSeed and prepare aside).
+class GrainJitter
+{
+public:
+    // one grain's offsets
+    struct Draw
+    {
+        float spray { 0.0f };   // 0 to 1
+        float pan { 0.0f };     // -1 to 1
+        float pitch { 0.0f };   // -1 to 1
+    };
+    
+    // starts from a seed of its own, like juce::Random
+    GrainJitter();
+    
+    // not while rendering; sizes the batch for up to maxGrainsPerBatch grains
+    void prepare(int maxGrainsPerBatch);
+    
+    // restarts the sequence; the same seed always gives the same sequence
+    void setSeed(juce::int64 seed) noexcept;
+    
+    // works out the next numGrains grains' offsets (at most the prepared batch size),
+    // dropping whatever the last batch didn't use
+    void fill(int numGrains) noexcept;
+    
+    // the next grain's offsets; starts a new batch if this one has run out
+    Draw next() noexcept
+    {
+        jassert (! mBase.empty());
+        
+        if (mNext >= mNumFilled)
+            fill(juce::jmax(1, mNumFilled));
+        
+        const auto index = static_cast<size_t>(mNext++);
+        return { mSpray[index], mPan[index], mPitch[index] };
+    }
+
+private:
+    //==============================================================================
+    // a bijective 32-bit integer hash with good avalanche (Wellons' "lowbias32")
+    static constexpr juce::uint32 hash(juce::uint32 x) noexcept
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352dU;
+        x ^= x >> 15;
+        x *= 0x846ca68bU;
+        x ^= x >> 16;
+        return x;
+    }
+    
+    // each stream hashes the grain's base hash with a key of its own
+    static constexpr std::array<juce::uint32, 3> mStreamKeys { 0x9e3779b9U, 0x85ebca6bU, 0xc2b2ae35U };
+    
+    juce::uint32 mKey { 0 };
+    juce::uint32 mCounter { 0 };    // the index of the batch's first grain
+    int mNext { 0 };
+    int mNumFilled { 0 };
+    
+    std::vector<juce::uint32> mBase;
+    std::vector<float> mSpray;
+    std::vector<float> mPan;
+    std::vector<float> mPitch;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GrainJitter)
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "CircularBuffer.h"
+#include "Interpolation.h"
+
+//==============================================================================
+// Where grains read their audio from. Voices only talk to this interface, so the live
+// CircularBuffer and pre-recorded material are interchangeable.
+//
+// getGrainStart() and readBlock() are called from the audio thread and from voice
+// workers at the same time, so implementations must not change shared state in them
+// (other than through atomics).
+class GrainSource
+{
+public:
+    virtual ~GrainSource() = default;
+    
+    // frames a grain phase can address
+    virtual juce::int64 getLength() const = 0;
+    virtual int getNumChannels() const = 0;
+    
+    // where a grain phase lies in the material, from 0 to 1, for drawing it
+    virtual double getNormalisedPosition(FixedPoint::Phase phase) const { return FixedPoint::toDouble(phase) / static_cast<double>(getLength()); }
+    
+    // frames of material per output sample at rate 1; material recorded at another
+    // sample rate than the host's scales every grain's rate by this to keep its pitch
+    virtual double getRateScale() const { return 1.0; }
+    
+    // Start phase of a grain of length frames read at rate, spawned blockOffset samples
+    // into the current block. position is the 0-1 Position control and spraySamples the
+    // grain's random offset.
+    virtual FixedPoint::Phase getGrainStart(int blockOffset, float position, float spraySamples, float rate, int length) = 0;
+    
+    // Reads numSamples interpolated frames of channels [0, numChannels) from readPhase,
+    // advancing by increment; returns the phase after the last one. workspace is the
+    // calling voice's own scratch, for sources that have to convert their data before
+    // interpolating it. There is one overload per processing precision.
+    virtual FixedPoint::Phase readBlock(Interpolation::Mode mode, float* const* destinations, int numChannels, int numSamples,
+                                        FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<float>& workspace) = 0;
+    virtual FixedPoint::Phase readBlock(Interpolation::Mode mode, double* const* destinations, int numChannels, int numSamples,
+                                        FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<double>& workspace) = 0;
+    
+    // frames in the workspace each voice should allocate
+    static constexpr int mWorkspaceSize { 4096 };
+};
+
+//==============================================================================
+// The live input: grains read behind the write head of the CircularBuffer. Phases are
+// in input time rather than buffer indices, so they stay valid when the buffer is
+// resized under them.
+//
+// Each processing precision has its own buffer and source, so only the readBlock()
+// overload matching SampleType is ever called.
+template <typename SampleType>
+class LiveGrainSource : public GrainSource
+{
+public:
+    explicit LiveGrainSource(CircularBuffer<SampleType>& bufferToRead) : mBuffer(bufferToRead) {}
+    
+    juce::int64 getLength() const override { return mBuffer.getBufferSize(); }
+    int getNumChannels() const override { return mBuffer.getNumChannels(); }
+    
+    double getNormalisedPosition(FixedPoint::Phase phase) const override
+    {
+        return FixedPoint::toDouble(mBuffer.toBufferPhase(phase)) / static_cast<double>(mBuffer.getBufferSize());
+    }
+    
+    FixedPoint::Phase getGrainStart(int blockOffset, float position, float spraySamples, float rate, int length) override
+    {
+        const auto bufferLength = static_cast<double>(mBuffer.getBufferSize());
+        const auto head = mBuffer.getWriteHead();
+        
+        // keep the whole grain inside the written part of the buffer: fast grains start
+        // further back so they never overtake the write head
+        const double delay = mBuffer.clampReadDelay(static_cast<double>(position) * bufferLength + static_cast<double>(spraySamples), rate, length);
+        
+        return FixedPoint::fromFrames(head.blockStart + blockOffset) - FixedPoint::fromDouble(delay);
+    }
+    
+    FixedPoint::Phase readBlock(Interpolation::Mode mode, float* const* destinations, int numChannels, int numSamples,
+                                FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<float>& workspace) override
+    {
+        return read(mode, destinations, numChannels, numSamples, readPhase, increment, workspace);
+    }
+    
+    FixedPoint::Phase readBlock(Interpolation::Mode mode, double* const* destinations, int numChannels, int numSamples,
+                                FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<double>& workspace) override
+    {
+        return read(mode, destinations, numChannels, numSamples, readPhase, increment, workspace);
+    }
+
+private:
+    template <typename DestinationType>
+    FixedPoint::Phase read(Interpolation::Mode mode, DestinationType* const* destinations, int numChannels, int numSamples,
+                           FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<DestinationType>& workspace)
+    {
+        if constexpr (std::is_same_v<DestinationType, SampleType>)
+        {
+            const auto bufferPhase = mBuffer.toBufferPhase(readPhase);
+        
+            Interpolation::dispatch(mode, [&] (auto kernel)
+            {
+                mBuffer.template readBlock<decltype(kernel)>(destinations, numChannels, numSamples, bufferPhase, increment, workspace);
+            });
+        }
+        else
+        {
+            // a voice of the other precision reading this buffer is a wiring bug
+            juce::ignoreUnused(mode, workspace);
+            jassertfalse;
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                juce::FloatVectorOperations::clear(destinations[channel], numSamples);
+        }
+        
+        // in input time, which wraps at 2^32 frames like the phase itself
+        return readPhase + increment * static_cast<FixedPoint::Phase>(numSamples);
+    }
+
+    CircularBuffer<SampleType>& mBuffer;
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "ConstexprMath.h"
+
+//==============================================================================
+// Grain window tables. Every shape is generated at compile time into a table of
+// tableSize + 1 floats (4 KB, so all five stay in L1 together) running from phase 0
+// to phase 1, both ends at zero. Grains step through a table with a phase increment
+// and interpolate linearly between entries.
+namespace GrainWindow
+{
+    enum class Shape
+    {
+        hann,
+        tukey,
+        gaussian,
+        trapezoid,
+        exponentialDecay
+    };
+    
+    constexpr int tableSize { 1024 };
+    using Table = std::array<float, static_cast<size_t>(tableSize + 1)>;
+    
+    //==============================================================================
+    namespace detail
+    {
+        constexpr double tukeyTaper { 0.25 };           // fraction of the grain spent in each cosine ramp
+        constexpr double gaussianWidth { 0.35 };        // standard deviation, relative to the half-length
+        constexpr double trapezoidRamp { 0.2 };         // fraction of the grain spent in each linear ramp
+        constexpr double decayAttack { 0.05 };          // exponential decay: linear attack fraction
+        constexpr double decayRate { 5.0 };             // exponential decay: time constants over the decay
+        
+        constexpr double hann(double phase)
+        {
+            return 0.5 - 0.5 * ConstexprMath::cosine(2.0 * ConstexprMath::pi * phase);
+        }
+        
+        constexpr double tukey(double phase)
+        {
+            if (phase < tukeyTaper)
+                return 0.5 - 0.5 * ConstexprMath::cosine(ConstexprMath::pi * phase / tukeyTaper);
+            
+            if (phase > 1.0 - tukeyTaper)
+                return 0.5 - 0.5 * ConstexprMath::cosine(ConstexprMath::pi * (1.0 - phase) / tukeyTaper);
+            
+            return 1.0;
+        }
+        
+        constexpr double gaussianCurve(double x)
+        {
+            return ConstexprMath::exponential(-0.5 * x * x / (gaussianWidth * gaussianWidth));
+        }
+        
+        constexpr double gaussian(double phase)
+        {
+            // shifted and rescaled so the ends sit exactly at zero instead of clicking
+            constexpr double edge { gaussianCurve(1.0) };
+            
+            return (gaussianCurve(2.0 * phase - 1.0) - edge) / (1.0 - edge);
+        }
+        
+        constexpr double trapezoid(double phase)
+        {
+            if (phase < trapezoidRamp)
+                return phase / trapezoidRamp;
+            
+            if (phase > 1.0 - trapezoidRamp)
+                return (1.0 - phase) / trapezoidRamp;
+            
+            return 1.0;
+        }
+        
+        constexpr double exponentialDecay(double phase)
+        {
+            if (phase < decayAttack)
+                return phase / decayAttack;
+            
+            // rescaled so the tail reaches zero at the end of the grain
+            constexpr double edge { ConstexprMath::exponential(-decayRate) };
+            const double decay = ConstexprMath::exponential(-decayRate * (phase - decayAttack) / (1.0 - decayAttack));
+            
+            return (decay - edge) / (1.0 - edge);
+        }
+        
+        constexpr Table makeTable(Shape shape)
+        {
+            Table table {};
+            
+            for (int i = 0; i <= tableSize; ++i)
+            {
+                const double phase = static_cast<double>(i) / static_cast<double>(tableSize);
+                double value = 0.0;
+                
+                switch (shape)
+                {
+                    case Shape::hann:               value = hann(phase); break;
+                    case Shape::tukey:              value = tukey(phase); break;
+                    case Shape::gaussian:           value = gaussian(phase); break;
+                    case Shape::trapezoid:          value = trapezoid(phase); break;
+                    case Shape::exponentialDecay:   value = exponentialDecay(phase); break;
+                }
+                
+                table[static_cast<size_t>(i)] = static_cast<float>(value > 0.0 ? value : 0.0);
+            }
+            
+            return table;
+        }
+        
+        // one constant expression per shape keeps each well inside compiler step limits
+        inline constexpr Table hannTable { makeTable(Shape::hann) };
+        inline constexpr Table tukeyTable { makeTable(Shape::tukey) };
+        inline constexpr Table gaussianTable { makeTable(Shape::gaussian) };
+        inline constexpr Table trapezoidTable { makeTable(Shape::trapezoid) };
+        inline constexpr Table exponentialDecayTable { makeTable(Shape::exponentialDecay) };
+    }
+    
+    //==============================================================================
+    inline const float* getTable(Shape shape) noexcept
+    {
+        switch (shape)
+        {
+            case Shape::tukey:              return detail::tukeyTable.data();
+            case Shape::gaussian:           return detail::gaussianTable.data();
+            case Shape::trapezoid:          return detail::trapezoidTable.data();
+            case Shape::exponentialDecay:   return detail::exponentialDecayTable.data();
+            case Shape::hann:               break;
+        }
+        
+        return detail::hannTable.data();
+    }
+    
+    // Writes numSamples window values starting at phase and advancing by increment.
+    // Phases are computed from the start rather than accumulated, so every iteration
+    // is independent and the loop can be vectorized. The table stays float; only the
+    // output follows the voice's precision.
+    template <typename SampleType>
+    void render(const float* table, SampleType* destination, int numSamples, float phase, float increment) noexcept
+    {
+        const auto scale = static_cast<float>(tableSize);
+        
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float position = juce::jlimit(0.0f, scale, (phase + increment * static_cast<float>(i)) * scale);
+            const int index = juce::jmin(static_cast<int>(position), tableSize - 1);
+            const float frac = position - static_cast<float>(index);
+            
+            destination[i] = static_cast<SampleType>(table[index] + frac * (table[index + 1] - table[index]));
+        }
+    }
+}
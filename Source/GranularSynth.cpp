@@ -3,6 +3,11 @@
 //==============================================================================
 void AdsrData::update(const float attack, const float decay, const float sustain, const float release)
 {
+    // setParameters recalculates every rate, so skip it when nothing changed
+    if (attack == adsrParams.attack && decay == adsrParams.decay
+        && sustain == adsrParams.sustain && release == adsrParams.release)
+        return;
+    
     adsrParams.attack = attack;
     adsrParams.decay = decay;
     adsrParams.sustain = sustain;
@@ -12,107 +17,1022 @@ void AdsrData::update(const float attack, const float decay, const float sustain
 }
 
 //==============================================================================
-GranularSound::GranularSound() {}
-
-bool GranularSound::appliesToNote(int midiNoteNumber) { return true; }
-bool GranularSound::appliesToChannel(int midiChannel) { return true; }
-
-//==============================================================================
-GranularVoice::GranularVoice() {}
+template <typename SampleType>
+GranularVoice<SampleType>::GranularVoice() {}
 
-bool GranularVoice::canPlaySound (juce::SynthesiserSound* sound)
-{
-    return dynamic_cast<GranularSound*>(sound) != nullptr;
-}
-
-void GranularVoice::startNote(int midiNoteNumber, float velocity, juce::SynthesiserSound* sound, int /*currentPitchWheenPosition*/)
+template <typename SampleType>
+void GranularVoice<SampleType>::startNote(int midiNoteNumber, float velocity)
 {
+    mPlaybackRate = std::pow(2.0, (midiNoteNumber - 60) / 12.0);
+    
+    // a (re)triggered voice starts a fresh cloud
+    mNumActiveGrains = 0;
+    mOverlapAdd.reset();
+    mSamplesUntilNextGrain = 0.0f;
+    mIsActive = true;
+    
     adsr.noteOn();
 }
 
-void GranularVoice::stopNote(float velocity, bool allowTailOff)
+template <typename SampleType>
+void GranularVoice<SampleType>::stopNote(bool allowTailOff)
 {
     adsr.noteOff();
     
-    if (! allowTailOff || adsr.isActive())
-        clearCurrentNote();
+    if (! allowTailOff || ! adsr.isActive())
+    {
+        adsr.reset();
+        mNumActiveGrains = 0;
+        mOverlapAdd.reset();
+        mIsActive = false;
+    }
 }
 
-void GranularVoice::controllerMoved(int controllerNumber, int newControllerValue) {}
-
-void GranularVoice::pitchWheelMoved(int newPitchWheelValue) {}
+template <typename SampleType>
+void GranularVoice<SampleType>::applyEvent(const Event& event)
+{
+    switch (event.type)
+    {
+        case Event::Type::start:   startNote(event.midiNoteNumber, event.velocity); break;
+        case Event::Type::release: stopNote(true); break;
+        case Event::Type::stop:    stopNote(false); break;
+    }
+}
 
-void GranularVoice::prepareToPlay(double sampleRate, int samplesPerBlock, int outputChannels)
+template <typename SampleType>
+void GranularVoice<SampleType>::prepareToPlay(double sampleRate, int samplesPerBlock, int outputChannels)
 {
     reset();
     
     adsr.setSampleRate(sampleRate);
+    mSampleRate = sampleRate;
     
     juce::dsp::ProcessSpec spec;
     spec.sampleRate = sampleRate;
     spec.maximumBlockSize = samplesPerBlock;
     spec.numChannels = outputChannels;
     
-    for (int ch = 0; ch < numChannelsToProcess; ++ch)
+    // the pool is only ever sized here; the audio thread just recycles slots
+    mGrainPool.resize(mMaxGrainsPerVoice);
+    mNumActiveGrains = 0;
+    
+    mGrainScratch.setSize(juce::jmax(1, outputChannels), juce::jmax(1, samplesPerBlock));
+    mWindowScratch.resize(static_cast<size_t>(mGrainScratch.getNumSamples()));
+    mSourceWorkspace.setSize(juce::jmax(1, outputChannels), GrainSource::mWorkspaceSize);
+    
+    // rendering never resizes this; blocks longer than samplesPerBlock are taken in chunks
+    synthBuffer.setSize(outputChannels, juce::jmax(1, samplesPerBlock));
+    
+    // a segment spawns at most one grain per sample
+    mJitter.prepare(samplesPerBlock);
+    
+    // the last parameters pushed say whether the engine is needed
+    prepareOverlapAdd(mGrainParams.synthesis == GrainSynthesis::overlapAdd);
+    
+    gain.prepare(spec);
+    gain.setRampDurationSeconds(mSmoothingTimeSeconds);
+    gain.setGainDecibels(mGrainParams.gainDb);
+    
+    mSmoothedDensity.reset(sampleRate, mSmoothingTimeSeconds);
+    mSmoothedPosition.reset(sampleRate, mSmoothingTimeSeconds);
+    mSmoothedPitch.reset(sampleRate, mSmoothingTimeSeconds);
+    
+    mSmoothedDensity.setCurrentAndTargetValue(mGrainParams.density);
+    mSmoothedPosition.setCurrentAndTargetValue(mGrainParams.position);
+    mSmoothedPitch.setCurrentAndTargetValue(mGrainParams.pitch);
+    
+    isPrepared = true;
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::renderVoiceBuffer(const Event* events, int firstEvent, int blockOffset, int numSamples)
+{
+    jassert(canRender());
+    jassert(numSamples <= synthBuffer.getNumSamples());
+    
+    for (int channel = 0; channel < synthBuffer.getNumChannels(); ++channel)
+        synthBuffer.clear(channel, 0, numSamples);
+    
+    mBlockPosition = blockOffset;
+    
+    // render up to each of this voice's events, apply it on its exact sample, carry on
+    int position = 0;
+    
+    for (int i = firstEvent; i >= 0; i = events[i].nextForVoice)
     {
+        const auto& event = events[i];
+        const int eventPosition = event.sampleOffset - blockOffset;
+        
+        jassert(event.voice == this);
+        
+        // applied in an earlier chunk
+        if (eventPosition < 0)
+            continue;
         
+        if (eventPosition >= numSamples)
+            break;
+        
+        renderSegment(position, eventPosition - position);
+        applyEvent(event);
+        position = eventPosition;
     }
     
-    gain.prepare(spec);
-    gain.setGainLinear(0.1f);
+    renderSegment(position, numSamples - position);
     
-    isPrepared = true;
+    // gain
+    auto audioBlock = juce::dsp::AudioBlock<SampleType> { synthBuffer }.getSubBlock(0, static_cast<size_t>(numSamples));
+    gain.process(juce::dsp::ProcessContextReplacing<SampleType>(audioBlock));
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::renderSegment(int bufferOffset, int numSamples)
+{
+    if (numSamples <= 0)
+        return;
+    
+    // spawn grains due in this segment, then sum every active grain into synthBuffer
+    if (adsr.isActive())
+        scheduleGrains(numSamples);
+    else
+        advanceSmoothing(numSamples);
+    
+    renderGrains(bufferOffset, numSamples);
+    
+    if (mOverlapAdd.isActive())
+        mOverlapAdd.render(*mSource, mInterpolation, synthBuffer, bufferOffset, numSamples, mGrainScratch, mSourceWorkspace);
+    
+    // env
+    adsr.applyEnvelopeToBuffer(synthBuffer, bufferOffset, numSamples);
+    
+    // later grains in this block start relative to where this segment ended
+    mBlockPosition += numSamples;
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::mixVoiceBuffer(juce::AudioBuffer<SampleType>& outputBuffer, int startSample, int numSamples)
+{
+    const int numChannels = juce::jmin(outputBuffer.getNumChannels(), synthBuffer.getNumChannels());
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+        outputBuffer.addFrom( channel, startSample, synthBuffer, channel, 0, numSamples);
+    
+    mLevel = static_cast<float>(synthBuffer.getMagnitude(0, numSamples));
+    
+    if (! adsr.isActive())
+    {
+        mNumActiveGrains = 0;
+        mOverlapAdd.reset();
+        mIsActive = false;
+    }
 }
 
-void GranularVoice::renderNextBlock (juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples)
+template <typename SampleType>
+void GranularVoice<SampleType>::scheduleGrains(int numSamples)
 {
-    jassert(isPrepared);
+    int smoothedUpTo = 0;
     
-    if (! isVoiceActive())
+    // draw for as many grains as the segment can hold: the density only ramps between
+    // its current and target values. Draws left over are made again for later grains
+    if (mSamplesUntilNextGrain < static_cast<float>(numSamples))
+    {
+        const float maxDensity = juce::jmax(mSmoothedDensity.getCurrentValue(), mSmoothedDensity.getTargetValue()) * mLoadLimits.densityScale;
+        const float minInterval = juce::jmax(1.0f, static_cast<float>(mSampleRate) / juce::jmax(maxDensity, 0.01f));
+        
+        mJitter.fill(static_cast<int>((static_cast<float>(numSamples) - mSamplesUntilNextGrain) / minInterval) + 1);
+    }
+    
+    while (mSamplesUntilNextGrain < static_cast<float>(numSamples))
+    {
+        const int startOffset = static_cast<int>(mSamplesUntilNextGrain);
+        
+        // bring the smoothed controls up to the grain's onset
+        advanceSmoothing(startOffset - smoothedUpTo);
+        smoothedUpTo = startOffset;
+        
+        spawnGrain(startOffset);
+        
+        const float density = juce::jmax(mSmoothedDensity.getCurrentValue() * mLoadLimits.densityScale, 0.01f);
+        mSamplesUntilNextGrain += juce::jmax(1.0f, static_cast<float>(mSampleRate) / density);
+    }
+    
+    advanceSmoothing(numSamples - smoothedUpTo);
+    mSamplesUntilNextGrain -= static_cast<float>(numSamples);
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::spawnGrain(int startOffset)
+{
+    const int length = juce::jmax(1, static_cast<int>(mGrainParams.grainSizeMs * 0.001f * static_cast<float>(mSampleRate)));
+    const bool poolFull = mNumActiveGrains >= juce::jmin(static_cast<int>(mGrainPool.size()), mLoadLimits.maxGrainsPerVoice);
+    // the engine's envelopes are stereo, so wider layouts keep to the pool; spray and pitch
+    // spray give nearly every grain its own playhead, which the engine can't render exactly
+    const bool overlapAdd = mGrainParams.synthesis == GrainSynthesis::overlapAdd && length <= mOverlapAdd.getMaxGrainLength() && ! mPanner->isSpatial()
+                            && mGrainParams.sprayMs <= 0.0f && mGrainParams.pitchSpray <= 0.0f;
+    
+    // pool exhausted (or capped under load): drop the grain rather than allocate or steal,
+    // unless the overlap-add engine may take it
+    if (poolFull && ! overlapAdd)
         return;
     
-    // prepare synthBuffer
-    synthBuffer.setSize(outputBuffer.getNumChannels(), numSamples, false, false, true);
+    const auto draw = mJitter.next();
+    const float spray = mGrainParams.sprayMs * 0.001f * static_cast<float>(mSampleRate) * draw.spray;
+    const float pan = mGrainParams.panSpread * draw.pan;
+    const float pitch = mSmoothedPitch.getCurrentValue() + mGrainParams.pitchSpray * draw.pitch;
+    
+    // the rate only becomes fixed point once, so a note's pitch is as exact as double
+    const double rate = mPlaybackRate * std::pow(2.0, static_cast<double>(pitch) / 12.0) * mSource->getRateScale();
+    
+    const auto readPhase = mSource->getGrainStart(mBlockPosition + startOffset, mSmoothedPosition.getCurrentValue(), spray, static_cast<float>(rate), length);
+    const auto increment = FixedPoint::fromDouble(rate);
+    
+    const auto* gains = mPanner->getGains(pan);
+    
+    // grains the engine can't take (no playhead open or free) fall back to the pool
+    if (overlapAdd && mOverlapAdd.addGrain(startOffset, readPhase, increment, length, mGrainParams.window,
+                                           gains[0], gains[juce::jmin(1, mPanner->getNumChannels() - 1)]))
+        return;
+    
+    if (poolFull)
+        return;
+    
+    auto& grain = mGrainPool[static_cast<size_t>(mNumActiveGrains++)];
+    
+    grain.readPhase = readPhase;
+    grain.increment = increment;
+    grain.startOffset = startOffset;
+    grain.samplesRemaining = length;
+    grain.window = GrainWindow::getTable(mGrainParams.window);
+    grain.windowPhase = 0.0f;
+    grain.windowIncrement = 1.0f / static_cast<float>(length);
+    grain.gains = gains;
+    grain.pan = pan;
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::addSpatialGrain(const Grain& grain, const SampleType* const* sources, int numSourceChannels,
+                                                int destinationOffset, int numSamples)
+{
+    auto* const* destinations = synthBuffer.getArrayOfWritePointers();
+    
+    if (mPanner->rotatesSource(numSourceChannels))
+    {
+        // turning a sound field about the vertical leaves m = 0 alone and mixes each
+        // +m/-m pair of a degree by the cosine and sine of m times the azimuth
+        const auto* rotation = mPanner->getRotation(grain.pan);
+        
+        for (int degree = 0; degree <= mPanner->getAmbisonicOrder(); ++degree)
+        {
+            const int centre = degree * degree + degree;
+            
+            juce::FloatVectorOperations::add(destinations[centre] + destinationOffset, sources[centre], numSamples);
+            
+            for (int m = 1; m <= degree; ++m)
+            {
+                const auto cosine = static_cast<SampleType>(rotation[2 * (m - 1)]);
+                const auto sine = static_cast<SampleType>(rotation[2 * (m - 1) + 1]);
+                auto* cosineTerm = destinations[centre + m] + destinationOffset;
+                auto* sineTerm = destinations[centre - m] + destinationOffset;
+                
+                juce::FloatVectorOperations::addWithMultiply(cosineTerm, sources[centre + m], cosine, numSamples);
+                juce::FloatVectorOperations::addWithMultiply(cosineTerm, sources[centre - m], -sine, numSamples);
+                juce::FloatVectorOperations::addWithMultiply(sineTerm, sources[centre + m], sine, numSamples);
+                juce::FloatVectorOperations::addWithMultiply(sineTerm, sources[centre - m], cosine, numSamples);
+            }
+        }
+        
+        return;
+    }
     
-    synthBuffer.clear();
+    const auto* placements = mPanner->getSourcePlacements(numSourceChannels);
+    const int numOutputChannels = mPanner->getNumChannels();
     
-    // play from circular buffer
-    for (int channel = 0; channel < outputBuffer.getNumChannels(); ++channel)
+    for (int source = 0; source < numSourceChannels; ++source)
     {
-        auto* channelData = outputBuffer.getWritePointer (channel);
+        const auto& placement = placements[source];
         
-        for (int sample = 0; sample < outputBuffer.getNumSamples(); ++sample)
+        if (placement.direct)
         {
-            channelData[sample] = mReferencedRawBuffer->getSample(channel, mReadPosition[channel]);
+            juce::FloatVectorOperations::add(destinations[source] + destinationOffset, sources[source], numSamples);
+            continue;
+        }
+        
+        // channels this one doesn't reach (speakers away from it, LFE, harmonics that
+        // only pick up elevation) are skipped
+        const auto* gains = mPanner->getGains(grain.pan, placement.panOffset);
+        
+        for (int channel = 0; channel < numOutputChannels; ++channel)
+            if (gains[channel] != 0.0f)
+                juce::FloatVectorOperations::addWithMultiply(destinations[channel] + destinationOffset, sources[source],
+                                                             static_cast<SampleType>(gains[channel]), numSamples);
+    }
+}
 
-            mReadPosition[channel] += mPlaybackRate;
-            mReadPosition[channel] = wrap(mReadPosition[channel], static_cast<float>(mGranBufferLength));
+template <typename SampleType>
+void GranularVoice<SampleType>::renderGrains(int bufferOffset, int numSamples)
+{
+    jassert(mPanner->getNumChannels() == synthBuffer.getNumChannels());
+    
+    const int numOutputChannels = juce::jmin(synthBuffer.getNumChannels(), mPanner->getNumChannels());
+    const int numReadChannels = juce::jmin(mSource->getNumChannels(), mGrainScratch.getNumChannels());
+    const int scratchSize = mGrainScratch.getNumSamples();
+    
+    const bool spatial = mPanner->isSpatial();
+    auto* const* scratch = mGrainScratch.getArrayOfWritePointers();
+    auto* window = mWindowScratch.data();
+    
+    for (int i = 0; i < mNumActiveGrains;)
+    {
+        auto& grain = mGrainPool[static_cast<size_t>(i)];
+        
+        const int start = grain.startOffset;
+        const int numToRender = juce::jmin(numSamples - start, grain.samplesRemaining);
+            
+        auto readPhase = grain.readPhase;
+        float phase = grain.windowPhase;
+            
+        // the scratch only holds one block, so longer renders are taken in chunks
+        for (int offset = 0; offset < numToRender; offset += scratchSize)
+        {
+            const int chunk = juce::jmin(scratchSize, numToRender - offset);
+                
+            // the window is shared by every channel of the grain, and so is the index
+            // math of the read: all source channels come back in one frame-wise pass
+            GrainWindow::render(grain.window, window, chunk, phase, grain.windowIncrement);
+                
+            // one virtual call per chunk; the source runs a loop compiled for the kernel
+            readPhase = mSource->readBlock(mInterpolation, scratch, numReadChannels, chunk, readPhase, grain.increment, mSourceWorkspace);
+            
+            for (int channel = 0; channel < numReadChannels; ++channel)
+                juce::FloatVectorOperations::multiply(scratch[channel], window, chunk);
+            
+            if (spatial)
+            {
+                addSpatialGrain(grain, scratch, numReadChannels, bufferOffset + start + offset, chunk);
+            }
+            else
+            {
+                // a mono source feeds both output channels from the same windowed read
+                for (int channel = 0; channel < numOutputChannels; ++channel)
+                    juce::FloatVectorOperations::addWithMultiply(synthBuffer.getWritePointer(channel, bufferOffset + start + offset),
+                                                                 scratch[juce::jmin(channel, numReadChannels - 1)],
+                                                                 static_cast<SampleType>(grain.gains[channel]), chunk);
+            }
+        
+            phase += grain.windowIncrement * static_cast<float>(chunk);
         }
+        
+        grain.readPhase = readPhase;
+        grain.windowPhase = phase;
+        grain.samplesRemaining -= numToRender;
+        grain.startOffset = 0;
+        
+        // finished grains are swapped out so the active range stays packed
+        if (grain.samplesRemaining <= 0)
+            grain = mGrainPool[static_cast<size_t>(--mNumActiveGrains)];
+        else
+            ++i;
     }
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::advanceSmoothing(int numSamples)
+{
+    if (numSamples <= 0)
+        return;
     
-    // gain/env
-    juce::dsp::AudioBlock<float> audioBlock { synthBuffer };
-    gain.process(juce::dsp::ProcessContextReplacing<float>(audioBlock));
-    adsr.applyEnvelopeToBuffer(synthBuffer, 0, synthBuffer.getNumSamples());
+    // skip() is O(1) for linear ramps, so controls cost nothing per sample between onsets
+    mSmoothedDensity.skip(numSamples);
+    mSmoothedPosition.skip(numSamples);
+    mSmoothedPitch.skip(numSamples);
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::updateInterpolation(int numLiveGrains)
+{
+    const auto requested = (mGrainParams.interpolation == Interpolation::Mode::automatic)
+                               ? Interpolation::chooseForGrainCount(numLiveGrains)
+                               : mGrainParams.interpolation;
     
-    for (int channel = 0; channel < outputBuffer.getNumChannels(); ++channel)
+    mInterpolation = Interpolation::cheaperOf(requested, mLoadLimits.maxInterpolation);
+}
+
+template <typename SampleType>
+int GranularVoice<SampleType>::copyGrainPositions(GrainSnapshot::Dot* destination, int maxToCopy) const
+{
+    const int numToCopy = juce::jmin(mNumActiveGrains, maxToCopy);
+    
+    for (int i = 0; i < numToCopy; ++i)
     {
-        outputBuffer.addFrom( channel, startSample, synthBuffer, channel, 0, numSamples);
+        const auto& grain = mGrainPool[static_cast<size_t>(i)];
+        const int windowIndex = juce::jlimit(0, GrainWindow::tableSize, static_cast<int>(grain.windowPhase * static_cast<float>(GrainWindow::tableSize)));
         
-        if (! adsr.isActive())
-            clearCurrentNote();
+        destination[i].position = static_cast<float>(mSource->getNormalisedPosition(grain.readPhase));
+        destination[i].level = grain.window != nullptr ? grain.window[windowIndex] : 0.0f;
     }
+    
+    // then one dot per overlap-add playhead
+    int numCopied = numToCopy;
+    
+    mOverlapAdd.visitPlayheads([&] (FixedPoint::Phase readPhase, float level)
+    {
+        if (numCopied < maxToCopy)
+            destination[numCopied++] = { static_cast<float>(mSource->getNormalisedPosition(readPhase)), level };
+    });
+    
+    return numCopied;
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::setLoadLimits(const LoadGovernor::Limits& newLimits)
+{
+    mLoadLimits = newLimits;
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::setGrainParameters(const GrainParameters& newParams)
+{
+    mGrainParams = newParams;
+    
+    mSmoothedDensity.setTargetValue(newParams.density);
+    mSmoothedPosition.setTargetValue(newParams.position);
+    mSmoothedPitch.setTargetValue(newParams.pitch);
+    
+    gain.setGainDecibels(newParams.gainDb);
 }
 
-void GranularVoice::reset()
+template <typename SampleType>
+void GranularVoice<SampleType>::reset()
 {
     gain.reset();
     adsr.reset();
+    
+    mIsActive = false;
+    mLevel = 0.0f;
+    mNumActiveGrains = 0;
+    mOverlapAdd.reset();
+    mSamplesUntilNextGrain = 0.0f;
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::prepareOverlapAdd(bool shouldAllocate)
+{
+    if (shouldAllocate)
+        mOverlapAdd.prepare(mSampleRate, synthBuffer.getNumSamples());
+    else
+        mOverlapAdd.release();
+}
+
+template <typename SampleType>
+void GranularVoice<SampleType>::setGrainSource(GrainSource* newSource)
+{
+    if (newSource == mSource)
+        return;
+    
+    mSource = newSource;
+    mNumActiveGrains = 0;
+    mOverlapAdd.reset();
+}
+
+//==============================================================================
+template <typename SampleType>
+GranularSynthesiser<SampleType>::GranularSynthesiser()
+{
+    mEvents.reserve(static_cast<size_t>(mMaxEventsPerBlock));
+    mNoteChains.fill(-1);
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::setNumVoices(int numVoices)
+{
+    numVoices = juce::jmax(0, numVoices);
+    
+    while (static_cast<int>(mOwnedVoices.size()) > numVoices)
+        mOwnedVoices.pop_back();
+    
+    while (static_cast<int>(mOwnedVoices.size()) < numVoices)
+    {
+        mOwnedVoices.push_back(std::make_unique<Voice>());
+        mOwnedVoices.back()->setSpatialPanner(&mPanner);
+    }
+    
+    mVoices.clear();
+    
+    for (auto& voice : mOwnedVoices)
+        mVoices.push_back(voice.get());
+    
+    mVoiceStates.resize(mVoices.size());
+    mVoicesToRender.resize(mVoices.size());
+    mFirstEventsToRender.resize(mVoices.size());
+    
+    allNotesOff();
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::setLoadLimits(const LoadGovernor::Limits& limits)
+{
+    for (auto* voice : mVoices)
+        voice->setLoadLimits(limits);
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::setGrainSource(GrainSource* source)
+{
+    for (auto* voice : mVoices)
+        voice->setGrainSource(source);
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::setRandomSeed(juce::int64 seed)
+{
+    // neighbouring seeds would start correlated, so each voice gets a draw from the seed instead
+    juce::Random seeds(seed);
+    
+    for (auto* voice : mVoices)
+        voice->setRandomSeed(seeds.nextInt64());
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::fillGrainSnapshot(GrainSnapshot& snapshot) const
+{
+    snapshot.numGrains = 0;
+    
+    // every sounding voice is held or releasing
+    for (auto list : { ListID::held, ListID::releasing })
+    {
+        for (int i = getList(list).head; i >= 0; i = mVoiceStates[static_cast<size_t>(i)].next)
+        {
+            const auto* voice = mVoices[static_cast<size_t>(i)];
+            
+            if (voice->isVoiceActive())
+                snapshot.numGrains += voice->copyGrainPositions(snapshot.grains.data() + snapshot.numGrains,
+                                                                GrainSnapshot::maxGrains - snapshot.numGrains);
+        }
+    }
 }
 
-void GranularVoice::setReferencedBuffer(CircularBuffer<float>& circularBufferToReference)
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::allNotesOff()
 {
-    mReferencedRawBuffer = circularBufferToReference.getReferencedBuffer();
+    for (auto* voice : mVoices)
+        voice->reset();
     
-    mGranBufferLength = mReferencedRawBuffer->getNumSamples();
+    // every voice back on the free list, in index order
+    const int numVoices = static_cast<int>(mVoiceStates.size());
+    
+    for (int i = 0; i < numVoices; ++i)
+    {
+        auto& state = mVoiceStates[static_cast<size_t>(i)];
+        state = VoiceState {};
+        state.previous = i - 1;
+        state.next = (i + 1 < numVoices) ? i + 1 : -1;
+    }
+    
+    mLists.fill({});
+    getList(ListID::free) = { numVoices > 0 ? 0 : -1, numVoices - 1, numVoices };
+    mNoteChains.fill(-1);
+    
+    mSustainPedalDown.fill(false);
+    mEvents.clear();
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::renderNextBlock(juce::AudioBuffer<SampleType>& outputAudio, const juce::MidiBuffer& midiMessages, int startSample, int numSamples)
+{
+    mLastBlockStats = {};
+    
+    if (mVoices.empty())
+        return;
+    
+    clearEvents();
+    queueMidi(midiMessages, startSample, numSamples);
+    
+    // voices render at most their own buffer length at a time; no MIDI splitting
+    const int maxChunk = mVoices.front()->getMaxBlockSize();
+    
+    if (maxChunk <= 0)
+        return;
+    
+    for (int offset = startSample; offset < startSample + numSamples; offset += maxChunk)
+        renderChunk(outputAudio, offset, juce::jmin(maxChunk, startSample + numSamples - offset));
+    
+    // a voice whose tail (or stop) has finished is free for the next note-on
+    for (auto list : { ListID::held, ListID::releasing })
+    {
+        for (int i = getList(list).head; i >= 0;)
+        {
+            const int next = mVoiceStates[static_cast<size_t>(i)].next;
+            const auto* voice = mVoices[static_cast<size_t>(i)];
+        
+            if (voice->isVoiceActive())
+            {
+                ++mLastBlockStats.numActiveVoices;
+                mLastBlockStats.numActiveGrains += voice->getNumActiveGrains();
+            }
+            else
+            {
+                freeVoice(i);
+            }
+        
+            i = next;
+        }
+    }
+}
+
+//==============================================================================
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::queueMidi(const juce::MidiBuffer& midiMessages, int startSample, int numSamples)
+{
+    for (const auto metadata : midiMessages)
+    {
+        const int sampleOffset = metadata.samplePosition;
+        
+        if (sampleOffset < startSample)
+            continue;
+        
+        if (sampleOffset >= startSample + numSamples)
+            break;
+        
+        const auto message = metadata.getMessage();
+        const int channel = message.getChannel();
+        
+        if (message.isNoteOn())
+            handleNoteOn(sampleOffset, channel, message.getNoteNumber(), message.getFloatVelocity());
+        else if (message.isNoteOff())
+            handleNoteOff(sampleOffset, channel, message.getNoteNumber());
+        else if (message.isSustainPedalOn())
+            handleSustainPedal(sampleOffset, channel, true);
+        else if (message.isSustainPedalOff())
+            handleSustainPedal(sampleOffset, channel, false);
+        else if (message.isAllNotesOff())
+            handleAllNotesOff(sampleOffset, channel, true);
+        else if (message.isAllSoundOff())
+            handleAllNotesOff(sampleOffset, channel, false);
+    }
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::handleNoteOn(int sampleOffset, int midiChannel, int midiNoteNumber, float velocity)
+{
+    // a repeated note releases the voice already playing it, as juce::Synthesiser does
+    for (int i = getNoteChain(midiChannel, midiNoteNumber); i >= 0;)
+    {
+        const int next = mVoiceStates[static_cast<size_t>(i)].nextWithSameNote;
+        releaseVoice(i, sampleOffset);
+        i = next;
+    }
+    
+    const int voiceIndex = findVoiceToStart();
+    
+    if (voiceIndex < 0)
+        return;
+    
+    // a stolen voice is cut by the start event itself
+    auto& state = mVoiceStates[static_cast<size_t>(voiceIndex)];
+    
+    if (state.list != ListID::free)
+        ++mLastBlockStats.numSteals;
+    
+    if (state.list == ListID::held)
+        removeFromNoteChain(voiceIndex);
+    
+    state.midiNoteNumber = midiNoteNumber;
+    state.midiChannel = midiChannel;
+    state.keyDown = true;
+    state.sustained = false;
+    
+    // the newest note goes to the back, so the held list stays oldest-first
+    moveToList(voiceIndex, ListID::held);
+    
+    auto& chain = getNoteChain(midiChannel, midiNoteNumber);
+    state.nextWithSameNote = chain;
+    chain = voiceIndex;
+    
+    queueEvent(Event::Type::start, sampleOffset, voiceIndex, midiNoteNumber, velocity);
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::handleNoteOff(int sampleOffset, int midiChannel, int midiNoteNumber)
+{
+    const bool pedalDown = mSustainPedalDown[static_cast<size_t>(juce::jlimit(0, 16, midiChannel))];
+    
+    for (int i = getNoteChain(midiChannel, midiNoteNumber); i >= 0;)
+    {
+        auto& state = mVoiceStates[static_cast<size_t>(i)];
+        const int next = state.nextWithSameNote;
+        
+        if (state.keyDown)
+        {
+            state.keyDown = false;
+        
+            if (pedalDown)
+                state.sustained = true;
+            else
+                releaseVoice(i, sampleOffset);
+        }
+        
+        i = next;
+    }
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::handleSustainPedal(int sampleOffset, int midiChannel, bool isDown)
+{
+    mSustainPedalDown[static_cast<size_t>(juce::jlimit(0, 16, midiChannel))] = isDown;
+    
+    if (isDown)
+        return;
+    
+    for (int i = getList(ListID::held).head; i >= 0;)
+    {
+        const auto& state = mVoiceStates[static_cast<size_t>(i)];
+        const int next = state.next;
+        
+        if (state.midiChannel == midiChannel && state.sustained)
+            releaseVoice(i, sampleOffset);
+        
+        i = next;
+    }
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::handleAllNotesOff(int sampleOffset, int midiChannel, bool allowTailOff)
+{
+    for (auto list : { ListID::held, ListID::releasing })
+    {
+        for (int i = getList(list).head; i >= 0;)
+        {
+            const auto& state = mVoiceStates[static_cast<size_t>(i)];
+            const int next = state.next;
+        
+            if (state.midiChannel == midiChannel)
+            {
+                if (! allowTailOff)
+                {
+                    queueEvent(Event::Type::stop, sampleOffset, i);
+                    freeVoice(i);
+                }
+                else if (list == ListID::held)
+                {
+                    releaseVoice(i, sampleOffset);
+                }
+            }
+        
+            i = next;
+        }
+    }
+}
+
+template <typename SampleType>
+int GranularSynthesiser<SampleType>::findVoiceToStart() const
+{
+    const auto& free = getList(ListID::free);
+    const auto& held = getList(ListID::held);
+    const auto& releasing = getList(ListID::releasing);
+    
+    if (free.head >= 0 && held.size + releasing.size < mVoiceLimit)
+        return free.head;
+    
+    // the quietest of the voices that have been releasing longest, which are the ones
+    // nearest the end of their tails; a bounded look, so stealing stays O(1)
+    if (releasing.head >= 0)
+    {
+        int quietest = releasing.head;
+        int candidate = releasing.head;
+        
+        for (int n = 0; n < mNumStealCandidates && candidate >= 0; ++n)
+        {
+            if (mVoices[static_cast<size_t>(candidate)]->getLevel() < mVoices[static_cast<size_t>(quietest)]->getLevel())
+                quietest = candidate;
+        
+            candidate = mVoiceStates[static_cast<size_t>(candidate)].next;
+        }
+    
+        return quietest;
+    }
+    
+    // only held notes left: the oldest goes
+    return held.head;
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::queueEvent(typename Event::Type type, int sampleOffset, int voiceIndex, int midiNoteNumber, float velocity)
+{
+    // never grow the queue on the audio thread
+    if (mEvents.size() >= mEvents.capacity())
+    {
+        jassertfalse;
+        return;
+    }
+    
+    const int eventIndex = static_cast<int>(mEvents.size());
+    mEvents.push_back({ type, sampleOffset, mVoices[static_cast<size_t>(voiceIndex)], voiceIndex, midiNoteNumber, velocity });
+    
+    // events arrive in time order, so appending keeps each voice's chain in order too
+    auto& state = mVoiceStates[static_cast<size_t>(voiceIndex)];
+    
+    if (state.lastEvent >= 0)
+        mEvents[static_cast<size_t>(state.lastEvent)].nextForVoice = eventIndex;
+    else
+        state.firstEvent = eventIndex;
+    
+    state.lastEvent = eventIndex;
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::clearEvents()
+{
+    // only voices that had events have chains to cut
+    for (const auto& event : mEvents)
+    {
+        auto& state = mVoiceStates[static_cast<size_t>(event.voiceIndex)];
+        state.firstEvent = -1;
+        state.lastEvent = -1;
+    }
+    
+    mEvents.clear();
+}
+
+//==============================================================================
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::releaseVoice(int voiceIndex, int sampleOffset)
+{
+    auto& state = mVoiceStates[static_cast<size_t>(voiceIndex)];
+    
+    state.keyDown = false;
+    state.sustained = false;
+    
+    removeFromNoteChain(voiceIndex);
+    moveToList(voiceIndex, ListID::releasing);
+    queueEvent(Event::Type::release, sampleOffset, voiceIndex);
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::freeVoice(int voiceIndex)
+{
+    auto& state = mVoiceStates[static_cast<size_t>(voiceIndex)];
+    
+    if (state.list == ListID::held)
+        removeFromNoteChain(voiceIndex);
+    
+    moveToList(voiceIndex, ListID::free);
+    
+    state.midiNoteNumber = -1;
+    state.midiChannel = 0;
+    state.keyDown = false;
+    state.sustained = false;
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::moveToList(int voiceIndex, ListID list)
+{
+    unlink(voiceIndex);
+    
+    auto& state = mVoiceStates[static_cast<size_t>(voiceIndex)];
+    auto& target = getList(list);
+    
+    state.list = list;
+    state.previous = target.tail;
+    state.next = -1;
+    
+    if (target.tail >= 0)
+        mVoiceStates[static_cast<size_t>(target.tail)].next = voiceIndex;
+    else
+        target.head = voiceIndex;
+    
+    target.tail = voiceIndex;
+    ++target.size;
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::unlink(int voiceIndex)
+{
+    auto& state = mVoiceStates[static_cast<size_t>(voiceIndex)];
+    auto& list = getList(state.list);
+    
+    if (state.previous >= 0)
+        mVoiceStates[static_cast<size_t>(state.previous)].next = state.next;
+    else
+        list.head = state.next;
+    
+    if (state.next >= 0)
+        mVoiceStates[static_cast<size_t>(state.next)].previous = state.previous;
+    else
+        list.tail = state.previous;
+    
+    state.previous = -1;
+    state.next = -1;
+    --list.size;
+}
+
+template <typename SampleType>
+int& GranularSynthesiser<SampleType>::getNoteChain(int midiChannel, int midiNoteNumber) noexcept
+{
+    return mNoteChains[static_cast<size_t>(juce::jlimit(0, 16, midiChannel) * 128 + (midiNoteNumber & 127))];
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::removeFromNoteChain(int voiceIndex)
+{
+    auto& state = mVoiceStates[static_cast<size_t>(voiceIndex)];
+    
+    // chains are as long as the number of voices holding one note, so nearly always 1
+    for (int* link = &getNoteChain(state.midiChannel, state.midiNoteNumber); *link >= 0; link = &mVoiceStates[static_cast<size_t>(*link)].nextWithSameNote)
+    {
+        if (*link == voiceIndex)
+        {
+            *link = state.nextWithSameNote;
+            break;
+        }
+    }
+    
+    state.nextWithSameNote = -1;
 }
+
+//==============================================================================
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::renderChunk(juce::AudioBuffer<SampleType>& outputAudio, int blockOffset, int numSamples)
+{
+    if (! collectVoicesToRender(blockOffset, numSamples))
+        return;
+    
+    // inactive voices hold no grains, so this is the size of the whole cloud
+    int numLiveGrains = 0;
+    
+    for (int i = 0; i < mNumVoicesToRender; ++i)
+        numLiveGrains += mVoicesToRender[static_cast<size_t>(i)]->getNumActiveGrains();
+    
+    for (int i = 0; i < mNumVoicesToRender; ++i)
+        mVoicesToRender[static_cast<size_t>(i)]->updateInterpolation(numLiveGrains);
+    
+    mChunkOffset = blockOffset;
+    mNumSamplesToRender = numSamples;
+    
+    if (shouldRenderInParallel(numLiveGrains))
+        mWorkerPool.run(mNumVoicesToRender, &GranularSynthesiser::renderVoiceTask, this);
+    else
+        for (int i = 0; i < mNumVoicesToRender; ++i)
+            renderVoiceTask(this, i);
+    
+    // fixed summing order: same additions in the same order on either path
+    for (int i = 0; i < mNumVoicesToRender; ++i)
+        mVoicesToRender[static_cast<size_t>(i)]->mixVoiceBuffer(outputAudio, blockOffset, numSamples);
+}
+    
+template <typename SampleType>
+bool GranularSynthesiser<SampleType>::collectVoicesToRender(int blockOffset, int numSamples)
+{
+    mNumVoicesToRender = 0;
+    const auto chunk = ++mChunkCounter;
+    
+    auto collect = [&] (int voiceIndex, bool hasEvents)
+    {
+        auto& state = mVoiceStates[static_cast<size_t>(voiceIndex)];
+        auto* voice = mVoices[static_cast<size_t>(voiceIndex)];
+        
+        if (state.collectedForChunk == chunk || ! voice->canRender() || ! (hasEvents || voice->isVoiceActive()))
+            return;
+        
+        state.collectedForChunk = chunk;
+        mVoicesToRender[static_cast<size_t>(mNumVoicesToRender)] = voice;
+        mFirstEventsToRender[static_cast<size_t>(mNumVoicesToRender)] = state.firstEvent;
+        ++mNumVoicesToRender;
+    };
+    
+    // voices with events still to come; a voice stopped later in the block is already
+    // back on the free list but has to sound until its stop
+    for (const auto& event : mEvents)
+        if (event.sampleOffset >= blockOffset)
+            collect(event.voiceIndex, event.sampleOffset < blockOffset + numSamples);
+            
+    for (auto list : { ListID::held, ListID::releasing })
+        for (int i = getList(list).head; i >= 0; i = mVoiceStates[static_cast<size_t>(i)].next)
+            collect(i, false);
+    
+    return mNumVoicesToRender > 0;
+}
+
+template <typename SampleType>
+bool GranularSynthesiser<SampleType>::shouldRenderInParallel(int numLiveGrains) const
+{
+    return mParallelRendering.load(std::memory_order_relaxed)
+        && mWorkerPool.getNumWorkers() > 0
+        && mNumVoicesToRender > 1
+        && numLiveGrains >= mMinGrainsForParallel;
+}
+
+template <typename SampleType>
+void GranularSynthesiser<SampleType>::renderVoiceTask(void* context, int taskIndex)
+{
+    auto& synth = *static_cast<GranularSynthesiser*>(context);
+    
+    synth.mVoicesToRender[static_cast<size_t>(taskIndex)]->renderVoiceBuffer(synth.mEvents.data(),
+                                                                              synth.mFirstEventsToRender[static_cast<size_t>(taskIndex)],
+                                                                              synth.mChunkOffset,
+                                                                              synth.mNumSamplesToRender);
+}
+
+//==============================================================================
+template class GranularVoice<float>;
+template class GranularVoice<double>;
+template class GranularSynthesiser<float>;
+template class GranularSynthesiser<double>;
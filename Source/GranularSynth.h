@@ -1,8 +1,15 @@
 #pragma once
 
 #include <JuceHeader.h>
-#include "CircularBuffer.h"
+#include "GrainSource.h"
+#include "Interpolation.h"
+#include "GrainWindow.h"
 #include "Utilities.h"
+#include "VoiceWorkerPool.h"
+#include "LoadGovernor.h"
+#include "OverlapAddEngine.h"
+#include "GrainJitter.h"
+#include "SpatialPanner.h"
 
 //==============================================================================
 class AdsrData : public juce::ADSR
@@ -15,57 +22,391 @@ private:
 };
 
 //==============================================================================
-class GranularSound : public juce::SynthesiserSound
+// how a voice sums its grains; the order matches the Synthesis parameter's choices
+enum class GrainSynthesis
 {
-public:
-    GranularSound();
+    timeDomain,     // every grain reads and windows its own samples
+    overlapAdd      // grains share playheads in an OverlapAddEngine, for very dense clouds
+};
+
+//==============================================================================
+struct GrainParameters
+{
+    float grainSizeMs { 100.0f };
+    float density { 20.0f };        // grains per second
+    float position { 0.0f };        // 0 = live input, 1 = oldest material in the buffer
+    float sprayMs { 0.0f };         // maximum random offset behind the scan position
+    float pitch { 0.0f };           // semitones, on top of the note pitch
+    float pitchSpray { 0.0f };      // maximum random offset from the pitch, in semitones either way
+    float panSpread { 0.0f };       // 0 = centre, 1 = full random left/right (all the way round beyond stereo)
+    float gainDb { -20.0f };
+    Interpolation::Mode interpolation { Interpolation::Mode::automatic };
+    GrainWindow::Shape window { GrainWindow::Shape::hann };
+    GrainSynthesis synthesis { GrainSynthesis::timeDomain };
+};
+
+//==============================================================================
+// Plain state for a single grain; kept trivially copyable so the pool stays flat
+struct Grain
+{
+    FixedPoint::Phase readPhase { 0 };                  // in the GrainSource
+    FixedPoint::Phase increment { FixedPoint::one };    // playback rate, exact to 2^-32 of a frame
+    int startOffset { 0 };          // offset into the current block at which the grain starts sounding
+    int samplesRemaining { 0 };
+    const float* window { nullptr };    // GrainWindow table, fixed when the grain spawns
+    float windowPhase { 0.0f };
+    float windowIncrement { 0.0f };
+    const float* gains { nullptr };     // SpatialPanner row: one gain per output channel
+    float pan { 0.0f };                 // beyond stereo each source channel is placed from here
+};
+
+//==============================================================================
+// Where the grains are, for drawing; filled on the audio thread and handed to the
+// editor through a TripleBuffer
+struct GrainSnapshot
+{
+    struct Dot
+    {
+        float position { 0.0f };    // read position as a fraction of the buffer
+        float level { 0.0f };       // current window value
+    };
+    
+    static constexpr int maxGrains { 512 };
+    
+    std::array<Dot, maxGrains> grains;
+    int numGrains { 0 };
+};
+
+//==============================================================================
+template <typename SampleType>
+class GranularVoice;
+
+// A note event for one voice, at a sample offset into the block being rendered.
+// GranularSynthesiser queues these from MIDI; the voice applies them inside its
+// render loop, so notes start and stop on the exact sample without the block being
+// split into sub-blocks around them.
+template <typename SampleType>
+struct VoiceEvent
+{
+    enum class Type
+    {
+        start,          // start a note (the voice cuts whatever it was playing)
+        release,        // note-off with tail
+        stop            // immediate stop, no tail
+    };
     
-    bool appliesToNote(int midiNoteNumber) override;
-    bool appliesToChannel(int midiNoteNumber) override;
+    Type type { Type::start };
+    int sampleOffset { 0 };
+    GranularVoice<SampleType>* voice { nullptr };
+    int voiceIndex { -1 };          // the voice's index in the synthesiser
+    int midiNoteNumber { 0 };
+    float velocity { 0.0f };
+    int nextForVoice { -1 };        // the same voice's next event in the block's queue, or -1
 };
 
 //==============================================================================
-class GranularVoice : public juce::SynthesiserVoice
+// One note's grain cloud, rendered at SampleType (float or double) throughout.
+template <typename SampleType>
+class GranularVoice
 {
 public:
+    using Event = VoiceEvent<SampleType>;
+    
     GranularVoice();
     
-    bool canPlaySound (juce::SynthesiserSound* sound) override;
+    void prepareToPlay (double sampleRate, int samplesPerBlock, int outputChannels);
     
-    void startNote(int midiNoteNumber, float velocity, juce::SynthesiserSound* /*sound*/, int /*currentPitchWheenPosition*/) override;
+    void reset();
     
-    void stopNote(float /*velocity*/, bool allowTailOff) override;
+    // audio thread, between blocks; a new source drops the grains reading the old one
+    void setGrainSource(GrainSource* newSource);
     
-    void controllerMoved (int controllerNumber, int newControllerValue) override;
+    // the synthesiser's, set once when the voice is built
+    void setSpatialPanner(const SpatialPanner* panner) { mPanner = panner; }
     
-    void pitchWheelMoved (int newPitchWheelValue) override;
+    void setGrainParameters(const GrainParameters& newParams);
     
-    void prepareToPlay (double sampleRate, int samplesPerBlock, int outputChannels);
+    // fixes the sequence of spray, pan and pitch offsets, so renders can be repeated exactly
+    void setRandomSeed(juce::int64 seed) { mJitter.setSeed(seed); }
     
-    void renderNextBlock (juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) override;
+    AdsrData& getAdsr() { return adsr; }
     
-    void reset();
+    // an overlap-add playhead costs about what one grain does, so it counts as one
+    int getNumActiveGrains() const { return mNumActiveGrains + mOverlapAdd.getNumActivePlayheads(); }
     
-    void setReferencedBuffer(CircularBuffer<float>& circularBufferToReference);
+    // not while rendering (prepareToPlay, or the message thread with processing
+    // suspended); allocates the overlap-add engine, or frees it
+    void prepareOverlapAdd(bool shouldAllocate);
+    bool isOverlapAddPrepared() const { return mOverlapAdd.isPrepared(); }
     
-    //using juce::SynthesiserVoice::renderNextBlock;
+    // peak of the last chunk this voice mixed, after envelope and gain; used to pick
+    // the quietest voice to steal
+    float getLevel() const { return mLevel; }
     
-    AdsrData& getAdsr() { return adsr; }
+    // writes up to maxToCopy of the active grains' positions; returns how many
+    int copyGrainPositions(GrainSnapshot::Dot* destination, int maxToCopy) const;
+    
+    // true from a start event until the release tail (or a stop event) has finished
+    bool isVoiceActive() const { return mIsActive; }
+    
+    // Renders [blockOffset, blockOffset + numSamples) of the current block into the
+    // voice's own buffer, applying this voice's events at their offsets: the chain that
+    // starts at events[firstEvent] (-1 for none) and follows nextForVoice. Only touches
+    // this voice's state, so voices can render concurrently. numSamples <= getMaxBlockSize()
+    void renderVoiceBuffer(const Event* events, int firstEvent, int blockOffset, int numSamples);
+    
+    // adds the rendered buffer to the output; must run on the audio thread
+    void mixVoiceBuffer(juce::AudioBuffer<SampleType>& outputBuffer, int startSample, int numSamples);
+    
+    int getMaxBlockSize() const { return synthBuffer.getNumSamples(); }
+    bool canRender() const { return isPrepared && mSource != nullptr && mPanner != nullptr; }
+    
+    // resolves Mode::automatic against the number of grains live across all voices
+    void updateInterpolation(int numLiveGrains);
+    
+    // the LoadGovernor's current limits; they apply to grains spawned from now on
+    void setLoadLimits(const LoadGovernor::Limits& newLimits);
+    
+    static constexpr int mMaxGrainsPerVoice { 512 };
     
 private:
-    double level { 0.0 };
-    double tailOff { 0.0 };
+    void startNote(int midiNoteNumber, float velocity);
+    void stopNote(bool allowTailOff);
+    void applyEvent(const Event& event);
+    
+    void renderSegment(int bufferOffset, int numSamples);
+    void scheduleGrains(int numSamples);
+    void spawnGrain(int startOffset);
+    void renderGrains(int bufferOffset, int numSamples);
+    
+    // beyond stereo: adds a grain's windowed source channels to the output at
+    // destinationOffset, each placed (or the sound field rotated) by SpatialPanner
+    void addSpatialGrain(const Grain& grain, const SampleType* const* sources, int numSourceChannels, int destinationOffset, int numSamples);
+    void advanceSmoothing(int numSamples);
     
     static constexpr int numChannelsToProcess { 2 };
     AdsrData adsr;
-    juce::AudioBuffer<float> synthBuffer;
+    juce::AudioBuffer<SampleType> synthBuffer;
     
-    juce::dsp::Gain<float> gain;
+    juce::dsp::Gain<SampleType> gain;
     bool isPrepared { false };
+    bool mIsActive { false };
+    float mLevel { 0.0f };
+    double mSampleRate { 44100.0 };
+    static constexpr double mSmoothingTimeSeconds { 0.05 };
+    
+    GrainSource* mSource = nullptr;
+    const SpatialPanner* mPanner = nullptr;
+    
+    //==============================================================================
+    // grain pool: active grains are packed at the front, so rendering walks a contiguous range
+    std::vector<Grain> mGrainPool;
+    int mNumActiveGrains { 0 };
+    
+    // takes the grains instead of the pool while the synthesis mode is Overlap-Add
+    OverlapAddEngine<SampleType> mOverlapAdd;
+    
+    // one block of source frames per grain (all channels read together by
+    // GrainSource::readBlock), and the matching stretch of the grain's window
+    juce::AudioBuffer<SampleType> mGrainScratch;
+    std::vector<SampleType> mWindowScratch;
+    
+    // for sources that convert their data before interpolating it; one per voice, so
+    // voices rendering on different threads never share it
+    juce::AudioBuffer<SampleType> mSourceWorkspace;
+    
+    GrainParameters mGrainParams;
+    Interpolation::Mode mInterpolation { Interpolation::Mode::linear };
+    LoadGovernor::Limits mLoadLimits;
+    
+    // continuous controls ramp towards their targets; the scheduler reads them at grain onsets
+    juce::SmoothedValue<float> mSmoothedDensity;
+    juce::SmoothedValue<float> mSmoothedPosition;
+    juce::SmoothedValue<float> mSmoothedPitch;
+    
+    // filled once per segment with every grain it can spawn
+    GrainJitter mJitter;
+    
+    float mSamplesUntilNextGrain { 0.0f };
+    
+    // samples into the current block, which is where the source puts "now"
+    int mBlockPosition { 0 };
+    double mPlaybackRate { 1.0 };
+};
+
+//==============================================================================
+// Owns the voices, turns MIDI into VoiceEvents and renders whole blocks.
+//
+// Unlike juce::Synthesiser it never splits a block at MIDI events: note-ons, note-offs
+// and the sustain pedal are resolved to voices up front into a preallocated queue, and
+// every voice renders the block once, applying its own events at their sample offsets.
+// Dense MIDI therefore costs a few queue entries rather than extra render calls.
+//
+// Voices live in a pool sized by setNumVoices. Every voice is on exactly one of three
+// intrusive lists (free, held, releasing), and held voices are also chained per MIDI
+// channel and note, so starting, releasing and stealing a voice never scans the pool:
+// note-on takes the head of the free list, or steals the quietest of the few longest
+// releasing voices, or failing that the oldest held one. Per-block work only walks the
+// held and releasing lists, so a large pool costs nothing while it is idle.
+//
+// Voices can be spread over a VoiceWorkerPool. Each voice renders into its own buffer
+// on whichever thread picks it up, then the buffers are added to the output in the
+// order they were collected, on the audio thread, so the result is bit-identical to
+// rendering the voices one after another.
+//
+// Instantiated for float and double, so hosts mixing in double get a native path.
+template <typename SampleType>
+class GranularSynthesiser
+{
+public:
+    using Voice = GranularVoice<SampleType>;
+    using Event = VoiceEvent<SampleType>;
+    
+    GranularSynthesiser();
+    
+    // message thread or prepareToPlay; keeps existing voices, adds or removes voices at
+    // the end to reach numVoices, and frees every voice. New voices still need preparing
+    void setNumVoices(int numVoices);
+    int getNumVoices() const noexcept { return static_cast<int>(mVoices.size()); }
+    
+    // audio thread; note-ons steal once this many voices are sounding (never more than
+    // setNumVoices built). Lowering it leaves sounding voices alone
+    void setVoiceLimit(int maxSoundingVoices) noexcept { mVoiceLimit = maxSoundingVoices; }
+    
+    const std::vector<Voice*>& getVoices() const noexcept { return mVoices; }
+    
+    void renderNextBlock(juce::AudioBuffer<SampleType>& outputAudio, const juce::MidiBuffer& midiMessages, int startSample, int numSamples);
+    
+    // message thread; 0 workers keeps everything on the audio thread, otherwise the
+    // workers are scheduled for blocks of samplesPerBlock at sampleRate
+    void setNumWorkerThreads(int numWorkers, double sampleRate = 0.0, int samplesPerBlock = 0) { mWorkerPool.setNumWorkers(numWorkers, sampleRate, samplesPerBlock); }
+    
+    void setParallelRendering(bool shouldRenderInParallel) noexcept { mParallelRendering.store(shouldRenderInParallel); }
+    
+    // audio thread, between blocks
+    void setLoadLimits(const LoadGovernor::Limits& limits);
+    void setGrainSource(GrainSource* source);
+    
+    // message thread or prepareToPlay, before the voices are prepared with as many
+    // channels; builds the gain table every voice places its grains with
+    void setOutputLayout(const juce::AudioChannelSet& layout) { mPanner.prepare(layout); }
+    
+    // seeds every voice from one seed; the same seed and input give the same output
+    void setRandomSeed(juce::int64 seed);
+    
+    // clears every voice and all note bookkeeping, e.g. after a re-prepare
+    void allNotesOff();
+    
+    // counts for the last renderNextBlock call, for telemetry
+    struct BlockStats
+    {
+        int numActiveVoices { 0 };
+        int numActiveGrains { 0 };
+        int numSteals { 0 };
+    };
+    
+    const BlockStats& getLastBlockStats() const noexcept { return mLastBlockStats; }
+    
+    // audio thread, between blocks
+    void fillGrainSnapshot(GrainSnapshot& snapshot) const;
+    
+    // below this many active grains the hand-off costs more than it saves
+    static constexpr int mMinGrainsForParallel { 64 };
+
+    // events beyond this in one block are dropped (and asserted on)
+    static constexpr int mMaxEventsPerBlock { 1024 };
+
+    // how many of the longest-releasing voices are compared when stealing the quietest
+    static constexpr int mNumStealCandidates { 4 };
+
+private:
+    //==============================================================================
+    enum class ListID
+    {
+        free,
+        held,           // key down, or released while the pedal was down
+        releasing       // in its release tail (or not yet found to be silent)
+    };
+    
+    // doubly linked through VoiceState, oldest at the head
+    struct VoiceList
+    {
+        int head { -1 };
+        int tail { -1 };
+        int size { 0 };
+    };
+    
+    // what the synthesiser knows about a voice while queueing events
+    struct VoiceState
+    {
+        int midiNoteNumber { -1 };      // -1 when free
+        int midiChannel { 0 };
+        bool keyDown { false };
+        bool sustained { false };       // key released while the pedal was down
+        
+        ListID list { ListID::free };
+        int previous { -1 };
+        int next { -1 };
+        int nextWithSameNote { -1 };    // held voices only
+        juce::uint32 collectedForChunk { 0 };
+        
+        // this block's events for the voice, chained through VoiceEvent::nextForVoice,
+        // so a voice never scans the others' events
+        int firstEvent { -1 };
+        int lastEvent { -1 };
+    };
+    
+    void queueMidi(const juce::MidiBuffer& midiMessages, int startSample, int numSamples);
+    void handleNoteOn(int sampleOffset, int midiChannel, int midiNoteNumber, float velocity);
+    void handleNoteOff(int sampleOffset, int midiChannel, int midiNoteNumber);
+    void handleSustainPedal(int sampleOffset, int midiChannel, bool isDown);
+    void handleAllNotesOff(int sampleOffset, int midiChannel, bool allowTailOff);
+    int findVoiceToStart() const;
+    void queueEvent(typename Event::Type type, int sampleOffset, int voiceIndex, int midiNoteNumber = 0, float velocity = 0.0f);
+    void clearEvents();
+    
+    void releaseVoice(int voiceIndex, int sampleOffset);
+    void freeVoice(int voiceIndex);
+    void moveToList(int voiceIndex, ListID list);
+    void unlink(int voiceIndex);
+    VoiceList& getList(ListID list) noexcept { return mLists[static_cast<size_t>(list)]; }
+    const VoiceList& getList(ListID list) const noexcept { return mLists[static_cast<size_t>(list)]; }
+    int& getNoteChain(int midiChannel, int midiNoteNumber) noexcept;
+    void removeFromNoteChain(int voiceIndex);
+    
+    void renderChunk(juce::AudioBuffer<SampleType>& outputAudio, int blockOffset, int numSamples);
+    bool collectVoicesToRender(int blockOffset, int numSamples);
+    bool shouldRenderInParallel(int numLiveGrains) const;
+    static void renderVoiceTask(void* context, int taskIndex);
+    
+    //==============================================================================
+    std::vector<std::unique_ptr<Voice>> mOwnedVoices;
+    std::vector<Voice*> mVoices;
+    SpatialPanner mPanner;
+    std::vector<VoiceState> mVoiceStates;
+    
+    std::array<VoiceList, 3> mLists;
+    int mVoiceLimit { std::numeric_limits<int>::max() };
+    
+    // first held voice for each MIDI channel (0-16) and note
+    std::array<int, 17 * 128> mNoteChains;
+    
+    std::array<bool, 17> mSustainPedalDown {};
+    
+    // this block's events, in time order; reserved up front and only ever cleared
+    std::vector<Event> mEvents;
+    
+    // voices with output or events in the current chunk, and where each one's events
+    // start; sized in setNumVoices
+    std::vector<Voice*> mVoicesToRender;
+    std::vector<int> mFirstEventsToRender;
+    int mNumVoicesToRender { 0 };
+    juce::uint32 mChunkCounter { 0 };
+    int mChunkOffset { 0 };
+    int mNumSamplesToRender { 0 };
     
-    int mGranBufferLength = 44100;
-    std::shared_ptr<juce::AudioBuffer<float>> mReferencedRawBuffer = nullptr;
+    std::atomic<bool> mParallelRendering { false };
+    VoiceWorkerPool mWorkerPool;
     
-    std::vector<float> mReadPosition { 0.0f, 0.0f };
-    float mPlaybackRate = 1.5f;
+    BlockStats mLastBlockStats;
 };
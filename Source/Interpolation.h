@@ -0,0 +1,344 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "ConstexprMath.h"
+#include "FixedPoint.h"
+
+//==============================================================================
+// Interpolation kernels for CircularBuffer reads, used as template policies so each
+// read loop is compiled for one kernel only.
+//
+// A kernel reads tapsBefore samples before and tapsAfter samples after the integer
+// read index (data points at that index) and exposes:
+//   interpolate(data, frac)    one output sample
+//   getWeights(frac, weights)  the numTaps FIR weights for a fixed fraction, for
+//                              reads whose fraction never changes
+namespace Interpolation
+{
+    enum class Mode
+    {
+        automatic,      // picked from the number of live grains
+        linear,
+        hermite,
+        lagrange,
+        sinc
+    };
+    
+    //==============================================================================
+    struct Linear
+    {
+        static constexpr int tapsBefore { 0 };
+        static constexpr int tapsAfter { 1 };
+        static constexpr int numTaps { tapsBefore + tapsAfter + 1 };
+        
+        template <typename SampleType>
+        static SampleType interpolate(const SampleType* data, SampleType frac) noexcept
+        {
+            return data[0] + frac * (data[1] - data[0]);
+        }
+        
+        template <typename SampleType>
+        static void getWeights(SampleType frac, SampleType* weights) noexcept
+        {
+            weights[0] = static_cast<SampleType>(1) - frac;
+            weights[1] = frac;
+        }
+    };
+    
+    //==============================================================================
+    // 4-point, 3rd-order Hermite (Catmull-Rom)
+    struct Hermite4
+    {
+        static constexpr int tapsBefore { 1 };
+        static constexpr int tapsAfter { 2 };
+        static constexpr int numTaps { tapsBefore + tapsAfter + 1 };
+        
+        template <typename SampleType>
+        static SampleType interpolate(const SampleType* data, SampleType frac) noexcept
+        {
+            const SampleType half { static_cast<SampleType>(0.5) };
+            
+            const SampleType c1 = half * (data[1] - data[-1]);
+            const SampleType c2 = data[-1] - static_cast<SampleType>(2.5) * data[0] + static_cast<SampleType>(2) * data[1] - half * data[2];
+            const SampleType c3 = half * (data[2] - data[-1]) + static_cast<SampleType>(1.5) * (data[0] - data[1]);
+            
+            return ((c3 * frac + c2) * frac + c1) * frac + data[0];
+        }
+        
+        template <typename SampleType>
+        static void getWeights(SampleType frac, SampleType* weights) noexcept
+        {
+            const SampleType f2 = frac * frac;
+            const SampleType f3 = f2 * frac;
+            
+            weights[0] = static_cast<SampleType>(0.5) * (-f3 + static_cast<SampleType>(2) * f2 - frac);
+            weights[1] = static_cast<SampleType>(0.5) * (static_cast<SampleType>(3) * f3 - static_cast<SampleType>(5) * f2 + static_cast<SampleType>(2));
+            weights[2] = static_cast<SampleType>(0.5) * (static_cast<SampleType>(-3) * f3 + static_cast<SampleType>(4) * f2 + frac);
+            weights[3] = static_cast<SampleType>(0.5) * (f3 - f2);
+        }
+    };
+    
+    //==============================================================================
+    // 6-point, 5th-order Lagrange
+    struct Lagrange6
+    {
+        static constexpr int tapsBefore { 2 };
+        static constexpr int tapsAfter { 3 };
+        static constexpr int numTaps { tapsBefore + tapsAfter + 1 };
+        
+        template <typename SampleType>
+        static SampleType interpolate(const SampleType* data, SampleType frac) noexcept
+        {
+            SampleType weights[numTaps];
+            getWeights(frac, weights);
+            
+            SampleType sum {};
+            
+            for (int tap = 0; tap < numTaps; ++tap)
+                sum += weights[tap] * data[tap - tapsBefore];
+            
+            return sum;
+        }
+        
+        template <typename SampleType>
+        static void getWeights(SampleType frac, SampleType* weights) noexcept
+        {
+            // nodes at -2..3; weight k is prod_{j != k} (frac - j) / (k - j)
+            const SampleType dm2 = frac + static_cast<SampleType>(2);
+            const SampleType dm1 = frac + static_cast<SampleType>(1);
+            const SampleType d0 = frac;
+            const SampleType d1 = frac - static_cast<SampleType>(1);
+            const SampleType d2 = frac - static_cast<SampleType>(2);
+            const SampleType d3 = frac - static_cast<SampleType>(3);
+            
+            weights[0] = dm1 * d0 * d1 * d2 * d3 / static_cast<SampleType>(-120);
+            weights[1] = dm2 * d0 * d1 * d2 * d3 / static_cast<SampleType>(24);
+            weights[2] = dm2 * dm1 * d1 * d2 * d3 / static_cast<SampleType>(-12);
+            weights[3] = dm2 * dm1 * d0 * d2 * d3 / static_cast<SampleType>(12);
+            weights[4] = dm2 * dm1 * d0 * d1 * d3 / static_cast<SampleType>(-24);
+            weights[5] = dm2 * dm1 * d0 * d1 * d2 / static_cast<SampleType>(120);
+        }
+    };
+    
+    //==============================================================================
+    // Polyphase windowed sinc. The kernel is tabulated for numPhases + 1 fractional
+    // offsets at compile time (Blackman window, cutoff just below Nyquist, each phase
+    // normalised to unity gain); weights between two phases are interpolated linearly.
+    template <int numZeroCrossings, int numPhases>
+    struct WindowedSinc
+    {
+        static constexpr int tapsBefore { numZeroCrossings - 1 };
+        static constexpr int tapsAfter { numZeroCrossings };
+        static constexpr int numTaps { tapsBefore + tapsAfter + 1 };
+        
+        using Table = std::array<float, static_cast<size_t>((numPhases + 1) * numTaps)>;
+        
+        static constexpr Table makeTable()
+        {
+            constexpr double cutoff { 0.9 };
+            Table table {};
+            
+            for (int phase = 0; phase <= numPhases; ++phase)
+            {
+                const double frac = static_cast<double>(phase) / static_cast<double>(numPhases);
+                double weights[numTaps] {};
+                double sum = 0.0;
+                
+                for (int tap = 0; tap < numTaps; ++tap)
+                {
+                    const double x = static_cast<double>(tap - tapsBefore) - frac;
+                    const double t = x / static_cast<double>(numZeroCrossings);
+                    
+                    if (t <= -1.0 || t >= 1.0)
+                        continue;
+                    
+                    const double sinc = (x == 0.0) ? cutoff : ConstexprMath::sine(ConstexprMath::pi * cutoff * x) / (ConstexprMath::pi * x);
+                    const double window = 0.42 + 0.5 * ConstexprMath::cosine(ConstexprMath::pi * t) + 0.08 * ConstexprMath::cosine(2.0 * ConstexprMath::pi * t);
+                    
+                    weights[tap] = sinc * window;
+                    sum += weights[tap];
+                }
+                
+                for (int tap = 0; tap < numTaps; ++tap)
+                    table[static_cast<size_t>(phase * numTaps + tap)] = static_cast<float>(weights[tap] / sum);
+            }
+            
+            return table;
+        }
+        
+        static constexpr Table table { makeTable() };
+        
+        template <typename SampleType>
+        static void getWeights(SampleType frac, SampleType* weights) noexcept
+        {
+            const SampleType scaled = frac * static_cast<SampleType>(numPhases);
+            const int phase = juce::jmin(static_cast<int>(scaled), numPhases - 1);
+            const SampleType phaseFrac = scaled - static_cast<SampleType>(phase);
+            
+            const float* lower = table.data() + phase * numTaps;
+            const float* upper = lower + numTaps;
+            
+            for (int tap = 0; tap < numTaps; ++tap)
+                weights[tap] = static_cast<SampleType>(lower[tap]) + phaseFrac * static_cast<SampleType>(upper[tap] - lower[tap]);
+        }
+        
+        template <typename SampleType>
+        static SampleType interpolate(const SampleType* data, SampleType frac) noexcept
+        {
+            SampleType weights[numTaps];
+            getWeights(frac, weights);
+            
+            SampleType sum {};
+            
+            for (int tap = 0; tap < numTaps; ++tap)
+                sum += weights[tap] * data[tap - tapsBefore];
+            
+            return sum;
+        }
+    };
+    
+    using Sinc = WindowedSinc<8, 128>;
+    
+    //==============================================================================
+    // every kernel's taps fit inside these, so one buffer layout serves them all
+    constexpr int maxTapsBefore { Sinc::tapsBefore };
+    constexpr int maxTapsAfter { Sinc::tapsAfter };
+    
+    // Calls function with a default-constructed kernel for the given (resolved) mode,
+    // so code that only has the mode at run time still gets a loop per kernel:
+    //   dispatch(mode, [&] (auto kernel) { return read<decltype(kernel)>(...); })
+    template <typename Function>
+    decltype(auto) dispatch(Mode mode, Function&& function)
+    {
+        switch (mode)
+        {
+            case Mode::sinc:        return function(Sinc {});
+            case Mode::lagrange:    return function(Lagrange6 {});
+            case Mode::hermite:     return function(Hermite4 {});
+            case Mode::automatic:
+            case Mode::linear:      break;
+        }
+        
+        return function(Linear {});
+    }
+    
+    //==============================================================================
+    // Interpolates numSamples frames from data (one pointer per channel, each with the
+    // kernel's taps available around every index read) into destinations + offset,
+    // starting at readPhase and advancing by increment. The caller guarantees that no
+    // tap runs off the data, so the loops have no bounds checks at all.
+    template <typename Interpolator, int numChannels, typename SampleType>
+    void readSpan(const SampleType* const* data, SampleType* const* destinations, int offset, int numSamples,
+                  FixedPoint::Phase readPhase, FixedPoint::Phase increment) noexcept
+    {
+        // whole-sample rates keep the fraction constant, so the read is a fixed FIR:
+        // one vector op per tap and channel
+        if (increment == FixedPoint::one)
+        {
+            const auto startIndex = static_cast<int>(FixedPoint::getIndex(readPhase));
+            
+            SampleType weights[Interpolator::numTaps];
+            Interpolator::getWeights(FixedPoint::getFraction<SampleType>(readPhase), weights);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                const SampleType* firstTap = data[channel] + startIndex - Interpolator::tapsBefore;
+                SampleType* destination = destinations[channel] + offset;
+                
+                juce::FloatVectorOperations::copyWithMultiply(destination, firstTap, weights[0], numSamples);
+                
+                for (int tap = 1; tap < Interpolator::numTaps; ++tap)
+                    juce::FloatVectorOperations::addWithMultiply(destination, firstTap + tap, weights[tap], numSamples);
+            }
+            
+            return;
+        }
+        
+        // integer adds are exact, so the phase can simply be accumulated: no drift, and
+        // no float-to-int rounding to guard against. The channel loop has a constant trip
+        // count and unrolls
+        auto phase = readPhase;
+        
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const auto index = static_cast<int>(FixedPoint::getIndex(phase));
+            const auto frac = FixedPoint::getFraction<SampleType>(phase);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                destinations[channel][offset + i] = Interpolator::interpolate(data[channel] + index, frac);
+            
+            phase += increment;
+        }
+    }
+    
+    // Reads numSamples frames from material that has to be converted before it can be
+    // interpolated. fill(firstFrame, numFrames) converts frames [firstFrame, firstFrame
+    // + numFrames) of channels [0, numChannels) into the start of workspace; the read is
+    // taken a workspace-sized chunk at a time, each chunk going through readSpan.
+    // Phases are in frames of the material; returns the phase after the last frame read.
+    template <typename Interpolator, typename SampleType, typename FillFunction>
+    FixedPoint::Phase readThroughWorkspace(SampleType* const* destinations, int numChannels, int numSamples, FixedPoint::Phase readPhase,
+                                           FixedPoint::Phase increment, juce::AudioBuffer<SampleType>& workspace, FillFunction&& fill)
+    {
+        jassert(numChannels <= workspace.getNumChannels());
+        
+        // frames the interpolator needs around the span, plus one for rounding
+        constexpr int margin { Interpolator::tapsBefore + Interpolator::tapsAfter + 2 };
+        const int capacity = workspace.getNumSamples() - margin;
+        const auto* const* data = workspace.getArrayOfReadPointers();
+        
+        int offset = 0;
+        
+        while (offset < numSamples)
+        {
+            // the chunk is read relative to its first frame
+            const auto firstIndex = static_cast<juce::int64>(FixedPoint::getIndex(readPhase));
+            const auto frac = readPhase & FixedPoint::fractionMask;
+            
+            int count = numSamples - offset;
+            
+            if (increment > FixedPoint::one)
+                count = juce::jmin(count, juce::jmax(1, static_cast<int>(FixedPoint::fromFrames(capacity - 1) / increment)));
+            else
+                count = juce::jmin(count, capacity - 1);
+            
+            const int numFrames = static_cast<int>(FixedPoint::getIndex(frac + increment * static_cast<FixedPoint::Phase>(count - 1))) + margin;
+            fill(firstIndex - Interpolator::tapsBefore, numFrames);
+            
+            const auto start = FixedPoint::fromFrames(Interpolator::tapsBefore) + frac;
+            
+            if (numChannels == 2)
+            {
+                readSpan<Interpolator, 2>(data, destinations, offset, count, start, increment);
+            }
+            else
+            {
+                for (int channel = 0; channel < numChannels; ++channel)
+                    readSpan<Interpolator, 1>(data + channel, destinations + channel, offset, count, start, increment);
+            }
+            
+            readPhase += increment * static_cast<FixedPoint::Phase>(count);
+            offset += count;
+        }
+        
+        return readPhase;
+    }
+    
+    //==============================================================================
+    // resolved modes are ordered by cost, so the cheaper of two is the lower one
+    inline Mode cheaperOf(Mode a, Mode b) noexcept
+    {
+        jassert(a != Mode::automatic && b != Mode::automatic);
+        return static_cast<int>(a) < static_cast<int>(b) ? a : b;
+    }
+    
+    // quality for Mode::automatic: expensive kernels while the cloud is sparse, cheaper
+    // ones as the number of live grains (across all voices) grows
+    inline Mode chooseForGrainCount(int numLiveGrains) noexcept
+    {
+        if (numLiveGrains < 32)     return Mode::sinc;
+        if (numLiveGrains < 128)    return Mode::lagrange;
+        if (numLiveGrains < 256)    return Mode::hermite;
+        return Mode::linear;
+    }
+}
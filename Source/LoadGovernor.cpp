@@ -0,0 +1,63 @@
+#include "LoadGovernor.h"
+
+//==============================================================================
+LoadGovernor::LoadGovernor() {}
+
+void LoadGovernor::prepare(double sampleRate)
+{
+    mSampleRate = sampleRate;
+    reset();
+}
+
+void LoadGovernor::reset()
+{
+    mSmoothedLoad = 0.0f;
+    mLevel = 0;
+    mSecondsSinceChange = 0.0;
+    mSecondsBelowRecovery = 0.0;
+    
+    mLoad.store(0.0f, std::memory_order_relaxed);
+    mPublishedLevel.store(0, std::memory_order_relaxed);
+}
+
+bool LoadGovernor::update(double elapsedSeconds, int numSamples) noexcept
+{
+    if (numSamples <= 0)
+        return false;
+    
+    const double budget = static_cast<double>(numSamples) / mSampleRate;
+    const float load = static_cast<float>(elapsedSeconds / budget);
+    
+    // one-pole smoothing with a time constant in seconds, whatever the block size
+    const double timeConstant = (load > mSmoothedLoad) ? mRiseTimeSeconds : mFallTimeSeconds;
+    const float coefficient = static_cast<float>(1.0 - std::exp(-budget / timeConstant));
+    mSmoothedLoad += coefficient * (load - mSmoothedLoad);
+    
+    mLoad.store(mSmoothedLoad, std::memory_order_relaxed);
+    
+    mSecondsSinceChange += budget;
+    
+    const float threshold = mThreshold.load(std::memory_order_relaxed);
+    const int previousLevel = mLevel;
+    
+    if (mSmoothedLoad < threshold * mRecoveryRatio)
+        mSecondsBelowRecovery += budget;
+    else
+        mSecondsBelowRecovery = 0.0;
+    
+    if (! mEnabled.load(std::memory_order_relaxed))
+        mLevel = 0;
+    else if (mSmoothedLoad > threshold && mLevel < mNumLevels - 1 && mSecondsSinceChange >= mSettleTimeSeconds)
+        ++mLevel;
+    else if (mLevel > 0 && mSecondsBelowRecovery >= mRecoveryTimeSeconds)
+        --mLevel;
+    
+    if (mLevel == previousLevel)
+        return false;
+    
+    mSecondsSinceChange = 0.0;
+    mSecondsBelowRecovery = 0.0;
+    mPublishedLevel.store(mLevel, std::memory_order_relaxed);
+    
+    return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "Interpolation.h"
+
+//==============================================================================
+// Compares the time every processBlock took against its real-time budget
+// (numSamples / sampleRate) and keeps a smoothed load estimate. When the load stays above the threshold it steps
+// down one quality level at a time: fewer new grains, a cap on simultaneous grains,
+// then cheaper interpolation. It steps back up only once the load has stayed well
+// below the threshold for a while, so a cloud near the limit doesn't flicker between
+// levels. A thinner cloud is always preferable to a dropout.
+//
+// update() runs on the audio thread; getLoad() and getLevel() may be read from anywhere.
+class LoadGovernor
+{
+public:
+    // what the voices may use at the current level
+    struct Limits
+    {
+        float densityScale { 1.0f };                                // multiplies the density of new grains
+        int maxGrainsPerVoice { std::numeric_limits<int>::max() };  // simultaneous grains
+        Interpolation::Mode maxInterpolation { Interpolation::Mode::sinc };
+    };
+    
+    LoadGovernor();
+    
+    void prepare(double sampleRate);
+    void reset();
+    
+    // fraction of the block's budget (0-1) above which quality is reduced
+    void setThreshold(float newThreshold) noexcept { mThreshold.store(juce::jlimit(0.1f, 1.0f, newThreshold)); }
+    
+    // when disabled the load is still measured, but the level stays at full quality
+    void setEnabled(bool shouldBeEnabled) noexcept { mEnabled.store(shouldBeEnabled); }
+    
+    // call once per block with the time it took; returns true when the level changed,
+    // i.e. new limits need pushing to the voices
+    bool update(double elapsedSeconds, int numSamples) noexcept;
+    
+    const Limits& getLimits() const noexcept { return mLevels[static_cast<size_t>(mLevel)]; }
+    
+    float getLoad() const noexcept { return mLoad.load(std::memory_order_relaxed); }
+    int getLevel() const noexcept { return mPublishedLevel.load(std::memory_order_relaxed); }
+    
+    static constexpr int mNumLevels { 4 };
+
+private:
+    //==============================================================================
+    // level 0 is full quality; each level is cheaper than the one before
+    static constexpr std::array<Limits, mNumLevels> mLevels
+    { {
+        { 1.0f,  std::numeric_limits<int>::max(), Interpolation::Mode::sinc },
+        { 0.75f, 256,                             Interpolation::Mode::lagrange },
+        { 0.5f,  128,                             Interpolation::Mode::hermite },
+        { 0.25f, 64,                              Interpolation::Mode::linear }
+    } };
+    
+    // overloads are followed quickly, recovery is judged over a longer window
+    static constexpr double mRiseTimeSeconds { 0.02 };
+    static constexpr double mFallTimeSeconds { 0.3 };
+    
+    // after stepping down, give the cheaper settings time to show in the load
+    static constexpr double mSettleTimeSeconds { 0.1 };
+    
+    // recover only after this long below mRecoveryRatio * threshold
+    static constexpr double mRecoveryTimeSeconds { 1.0 };
+    static constexpr float mRecoveryRatio { 0.6f };
+    
+    double mSampleRate { 44100.0 };
+    
+    std::atomic<float> mThreshold { 0.8f };
+    std::atomic<bool> mEnabled { true };
+    
+    float mSmoothedLoad { 0.0f };
+    int mLevel { 0 };
+    double mSecondsSinceChange { 0.0 };
+    double mSecondsBelowRecovery { 0.0 };
+    
+    std::atomic<float> mLoad { 0.0f };
+    std::atomic<int> mPublishedLevel { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LoadGovernor)
+};
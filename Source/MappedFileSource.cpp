@@ -0,0 +1,234 @@
+#include "MappedFileSource.h"
+
+//==============================================================================
+class MappedFileSource::Prefetcher : public juce::Thread
+{
+public:
+    explicit Prefetcher(MappedFileSource& ownerSource)
+        : juce::Thread("Sample prefetch"), source(ownerSource)
+    {
+    }
+    
+    ~Prefetcher() override
+    {
+        stopThread(1000);
+    }
+    
+    void run() override
+    {
+        const auto& reader = *source.mReader;
+        
+        // one touch per page is enough to fault it in
+        const auto bytesPerFrame = juce::jmax(1, static_cast<int>(reader.numChannels * reader.bitsPerSample / 8));
+        const auto framesPerPage = juce::jmax(1, pageSize / bytesPerFrame);
+        
+        while (! threadShouldExit())
+        {
+            for (int slot = 0; slot < mNumPrefetchSlots; ++slot)
+            {
+                const auto start = source.mPrefetchStarts[static_cast<size_t>(slot)].load(std::memory_order_relaxed);
+                const auto length = source.mPrefetchLengths[static_cast<size_t>(slot)].load(std::memory_order_relaxed);
+                
+                if (start < 0)
+                    continue;
+                
+                const auto first = juce::jmax(static_cast<juce::int64>(0), start);
+                const auto last = juce::jmin(source.mLength - 1, start + length + source.mLookahead);
+                
+                for (auto frame = first; frame <= last; frame += framesPerPage)
+                    reader.touchSample(frame);
+            }
+            
+            wait(intervalMs);
+        }
+    }
+
+private:
+    static constexpr int pageSize { 4096 };
+    static constexpr int intervalMs { 5 };
+    
+    MappedFileSource& source;
+};
+
+//==============================================================================
+std::unique_ptr<MappedFileSource> MappedFileSource::create(const juce::File& file)
+{
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+    
+    for (int i = 0; i < formatManager.getNumKnownFormats(); ++i)
+    {
+        auto* format = formatManager.getKnownFormat(i);
+        
+        if (! format->canHandleFile(file))
+            continue;
+        
+        std::unique_ptr<juce::MemoryMappedAudioFormatReader> reader (format->createMemoryMappedReader(file));
+        
+        // mapping only reserves address space; nothing is read here
+        if (reader == nullptr || reader->lengthInSamples <= 0 || ! reader->mapEntireFile())
+            continue;
+        
+        if (reader->numChannels == 0 || static_cast<int>(reader->numChannels) > mMaxChannels)
+            return nullptr;
+        
+        // grain phases address 2^32 frames, which is a day at 48 kHz
+        if (reader->lengthInSamples > (juce::int64 { 1 } << FixedPoint::fractionBits))
+            return nullptr;
+        
+        return std::unique_ptr<MappedFileSource>(new MappedFileSource(file, std::move(reader)));
+    }
+    
+    return nullptr;
+}
+
+MappedFileSource::MappedFileSource(const juce::File& file, std::unique_ptr<juce::MemoryMappedAudioFormatReader> reader)
+    : mFile(file), mReader(std::move(reader))
+{
+    mLength = mReader->lengthInSamples;
+    mNumChannels = static_cast<int>(mReader->numChannels);
+    mLookahead = static_cast<juce::int64>(mLookaheadSeconds * mReader->sampleRate);
+    
+    resetPrefetch();
+    
+    mPrefetcher = std::make_unique<Prefetcher>(*this);
+    mPrefetcher->startThread(juce::Thread::Priority::low);
+}
+
+MappedFileSource::~MappedFileSource()
+{
+    // the prefetcher reads the reader, so it goes first
+    mPrefetcher.reset();
+}
+
+void MappedFileSource::prepare(double hostSampleRate)
+{
+    jassert(hostSampleRate > 0.0);
+    
+    mRateScale = mReader->sampleRate / hostSampleRate;
+    resetPrefetch();
+}
+
+void MappedFileSource::resetPrefetch() noexcept
+{
+    for (int slot = 0; slot < mNumPrefetchSlots; ++slot)
+    {
+        mPrefetchStarts[static_cast<size_t>(slot)].store(-1, std::memory_order_relaxed);
+        mPrefetchLengths[static_cast<size_t>(slot)].store(0, std::memory_order_relaxed);
+    }
+}
+
+//==============================================================================
+FixedPoint::Phase MappedFileSource::getGrainStart(int /*blockOffset*/, float position, float spraySamples, float rate, int length)
+{
+    // the file doesn't move, so Position scans through it directly and spray scatters
+    // grains forward from there; the whole grain stays inside the file. rate already
+    // includes getRateScale(), spray is still in output samples
+    const auto extent = static_cast<double>(rate) * static_cast<double>(length);
+    const auto latestStart = juce::jmax(0.0, static_cast<double>(mLength - 1) - extent);
+    const auto start = juce::jlimit(0.0, latestStart, static_cast<double>(position) * latestStart + static_cast<double>(spraySamples) * mRateScale);
+    
+    // after a jump the old spans are material no grain is about to read
+    const auto previousPosition = mLastPosition.exchange(position, std::memory_order_relaxed);
+    
+    if (static_cast<double>(std::abs(position - previousPosition)) * latestStart > static_cast<double>(mLookahead))
+        resetPrefetch();
+    
+    postPrefetch(static_cast<juce::int64>(start), static_cast<juce::int64>(extent) + 1);
+    
+    return FixedPoint::fromDouble(start);
+}
+
+void MappedFileSource::postPrefetch(juce::int64 start, juce::int64 numFrames) noexcept
+{
+    const auto slot = static_cast<size_t>(mNextPrefetchSlot.fetch_add(1, std::memory_order_relaxed) % mNumPrefetchSlots);
+    
+    // a torn start/length pair only makes the prefetcher touch the wrong pages once
+    mPrefetchLengths[slot].store(numFrames, std::memory_order_relaxed);
+    mPrefetchStarts[slot].store(start, std::memory_order_relaxed);
+}
+
+FixedPoint::Phase MappedFileSource::readBlock(Interpolation::Mode mode, float* const* destinations, int numChannels, int numSamples,
+                                              FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<float>& workspace)
+{
+    return read(mode, destinations, numChannels, numSamples, readPhase, increment, workspace);
+}
+
+FixedPoint::Phase MappedFileSource::readBlock(Interpolation::Mode mode, double* const* destinations, int numChannels, int numSamples,
+                                              FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<double>& workspace)
+{
+    return read(mode, destinations, numChannels, numSamples, readPhase, increment, workspace);
+}
+
+template <typename SampleType>
+FixedPoint::Phase MappedFileSource::read(Interpolation::Mode mode, SampleType* const* destinations, int numChannels, int numSamples,
+                                         FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<SampleType>& workspace) const
+{
+    return Interpolation::dispatch(mode, [&] (auto kernel)
+    {
+        return readWith<decltype(kernel)>(destinations, numChannels, numSamples, readPhase, increment, workspace);
+    });
+}
+
+template <typename Interpolator, typename SampleType>
+FixedPoint::Phase MappedFileSource::readWith(SampleType* const* destinations, int numChannels, int numSamples, FixedPoint::Phase readPhase,
+                                             FixedPoint::Phase increment, juce::AudioBuffer<SampleType>& workspace) const
+{
+    jassert(numChannels <= mNumChannels);
+    
+    return Interpolation::readThroughWorkspace<Interpolator>(destinations, numChannels, numSamples, readPhase, increment, workspace,
+                                                             [&] (juce::int64 firstFrame, int numFrames)
+                                                             {
+                                                                 fillWorkspace(workspace, numChannels, firstFrame, numFrames);
+                                                             });
+}
+
+template <typename SampleType>
+void MappedFileSource::fillWorkspace(juce::AudioBuffer<SampleType>& workspace, int numChannels, juce::int64 start, int numFrames) const
+{
+    jassert(numFrames <= workspace.getNumSamples());
+    
+    auto* const* channels = workspace.getArrayOfWritePointers();
+    
+    // silence before and after the file, the mapped frames in between
+    const auto first = static_cast<int>(juce::jlimit(static_cast<juce::int64>(0), static_cast<juce::int64>(numFrames), -start));
+    const auto end = static_cast<int>(juce::jlimit(static_cast<juce::int64>(first), static_cast<juce::int64>(numFrames), mLength - start));
+            
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        juce::FloatVectorOperations::clear(channels[channel], first);
+        juce::FloatVectorOperations::clear(channels[channel] + end, numFrames - end);
+    }
+    
+    // each span is one copy (and conversion) straight out of the mapped block; no I/O
+    // once it's paged in
+    if constexpr (std::is_same_v<SampleType, float>)
+    {
+        float* destinations[mMaxChannels] {};
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            destinations[channel] = channels[channel] + first;
+        
+        mReader->read(destinations, numChannels, start + first, end - first);
+    }
+    else
+    {
+        // the reader only converts to float, so double goes through a stack chunk
+        constexpr int chunkFrames { 256 };
+        float chunk[mMaxChannels][chunkFrames];
+        float* destinations[mMaxChannels] {};
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            destinations[channel] = chunk[channel];
+        
+        for (int position = first; position < end; position += chunkFrames)
+        {
+            const int numToCopy = juce::jmin(chunkFrames, end - position);
+            mReader->read(destinations, numChannels, start + position, numToCopy);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                for (int i = 0; i < numToCopy; ++i)
+                    channels[channel][position + i] = static_cast<SampleType>(chunk[channel][i]);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "GrainSource.h"
+
+//==============================================================================
+// Pre-recorded material read straight from a memory-mapped WAV or AIFF file.
+//
+// Opening maps the file without reading it, so even a file of hundreds of megabytes
+// loads instantly, and the OS only pages in (and keeps resident) the parts grains
+// actually play. The audio thread never decodes or touches the disk: it converts the
+// handful of mapped frames a grain needs into the voice's workspace and interpolates
+// from there. To keep page faults off the audio thread too, every grain start is
+// posted to a background thread that touches the pages around it, and the stretch
+// just after it, before later grains get there.
+class MappedFileSource : public GrainSource
+{
+public:
+    // nullptr if the file can't be memory-mapped (not an uncompressed WAV/AIFF)
+    static std::unique_ptr<MappedFileSource> create(const juce::File& file);
+    
+    ~MappedFileSource() override;
+    
+    juce::int64 getLength() const override { return mLength; }
+    int getNumChannels() const override { return mNumChannels; }
+    double getSampleRate() const { return mReader->sampleRate; }
+    const juce::File& getFile() const { return mFile; }
+    
+    // message thread or prepareToPlay, while no grain reads the source; plays the file
+    // at its own speed at the host's rate, and forgets earlier grains' prefetch spans
+    void prepare(double hostSampleRate);
+    
+    // stops the prefetcher touching the spans posted so far, e.g. once nothing plays them
+    void resetPrefetch() noexcept;
+    
+    double getRateScale() const override { return mRateScale; }
+    
+    FixedPoint::Phase getGrainStart(int blockOffset, float position, float spraySamples, float rate, int length) override;
+    FixedPoint::Phase readBlock(Interpolation::Mode mode, float* const* destinations, int numChannels, int numSamples,
+                                FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<float>& workspace) override;
+    FixedPoint::Phase readBlock(Interpolation::Mode mode, double* const* destinations, int numChannels, int numSamples,
+                                FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<double>& workspace) override;
+    
+    static constexpr int mMaxChannels { 8 };
+
+private:
+    //==============================================================================
+    class Prefetcher;
+    
+    MappedFileSource(const juce::File& file, std::unique_ptr<juce::MemoryMappedAudioFormatReader> reader);
+    
+    template <typename SampleType>
+    FixedPoint::Phase read(Interpolation::Mode mode, SampleType* const* destinations, int numChannels, int numSamples,
+                           FixedPoint::Phase readPhase, FixedPoint::Phase increment, juce::AudioBuffer<SampleType>& workspace) const;
+    
+    template <typename Interpolator, typename SampleType>
+    FixedPoint::Phase readWith(SampleType* const* destinations, int numChannels, int numSamples, FixedPoint::Phase readPhase,
+                               FixedPoint::Phase increment, juce::AudioBuffer<SampleType>& workspace) const;
+    
+    // converts frames [start, start + numFrames) into the workspace; silence outside the file
+    template <typename SampleType>
+    void fillWorkspace(juce::AudioBuffer<SampleType>& workspace, int numChannels, juce::int64 start, int numFrames) const;
+    
+    void postPrefetch(juce::int64 start, juce::int64 numFrames) noexcept;
+    
+    //==============================================================================
+    juce::File mFile;
+    std::unique_ptr<juce::MemoryMappedAudioFormatReader> mReader;
+    juce::int64 mLength { 0 };
+    int mNumChannels { 0 };
+    double mRateScale { 1.0 };
+    
+    // frames past each grain the prefetcher touches too: where the next grains are likely to reach
+    static constexpr double mLookaheadSeconds { 0.5 };
+    juce::int64 mLookahead { 0 };
+    
+    // the Position the last grain started from; a jump makes the old spans stale
+    std::atomic<float> mLastPosition { 0.0f };
+    
+    // recent grain spans for the prefetcher; written by whichever thread spawns the grain
+    static constexpr int mNumPrefetchSlots { 64 };
+    std::array<std::atomic<juce::int64>, mNumPrefetchSlots> mPrefetchStarts;
+    std::array<std::atomic<juce::int64>, mNumPrefetchSlots> mPrefetchLengths;
+    std::atomic<juce::uint32> mNextPrefetchSlot { 0 };
+    
+    std::unique_ptr<Prefetcher> mPrefetcher;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MappedFileSource)
+};
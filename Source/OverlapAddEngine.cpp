@@ -0,0 +1,303 @@
+#include "OverlapAddEngine.h"
+
+namespace
+{
+    // signed distance in frames between two phases (or increments)
+    double toFrames(FixedPoint::Phase difference) noexcept
+    {
+        return static_cast<double>(static_cast<juce::int64>(difference)) / static_cast<double>(FixedPoint::one);
+    }
+    
+    int getOrder(int size) noexcept
+    {
+        int order = 1;
+        
+        while ((1 << order) < size)
+            ++order;
+        
+        return order;
+    }
+    
+    // envelopes are kept in float; in double they are widened into converted first, so
+    // the multiply-add is one vector op either way
+    template <typename SampleType>
+    void addWithEnvelope(SampleType* destination, const SampleType* source, const float* envelope, SampleType* converted, int numSamples) noexcept
+    {
+        if constexpr (std::is_same_v<SampleType, float>)
+        {
+            juce::ignoreUnused(converted);
+            juce::FloatVectorOperations::addWithMultiply(destination, source, envelope, numSamples);
+        }
+        else
+        {
+            for (int i = 0; i < numSamples; ++i)
+                converted[i] = static_cast<SampleType>(envelope[i]);
+            
+            juce::FloatVectorOperations::addWithMultiply(destination, source, converted, numSamples);
+        }
+    }
+}
+
+//==============================================================================
+template <typename SampleType>
+void OverlapAddEngine<SampleType>::prepare(double sampleRate, int maxBlockSize)
+{
+    mMaxBlockSize = juce::jmax(1, maxBlockSize);
+    mMaxGrainLength = juce::jmax(1, static_cast<int>(mMaxGrainSeconds * sampleRate));
+    
+    // a segment's grains reach at most a block plus a grain ahead
+    const int maxOrder = getOrder(mMaxBlockSize + mMaxGrainLength);
+    mRingSize = 1 << maxOrder;
+    
+    mEnvelopes.assign(static_cast<size_t>(mMaxPlayheads * 2 * mRingSize), 0.0f);
+    
+    if constexpr (! std::is_same_v<SampleType, float>)
+        mEnvelopeScratch.assign(static_cast<size_t>(mMaxBlockSize), SampleType {});
+    mPendingGrains.resize(static_cast<size_t>(mMaxBlockSize));
+    
+    mWindow.assign(static_cast<size_t>(mMaxGrainLength), 0.0f);
+    
+    mWindowLength = 0;
+    
+    mPlayheads = {};
+    mNumActivePlayheads = 0;
+    mNumPendingGrains = 0;
+    mRingPosition = 0;
+}
+
+template <typename SampleType>
+void OverlapAddEngine<SampleType>::release()
+{
+    mMaxGrainLength = 0;
+    mMaxBlockSize = 0;
+    mRingSize = 0;
+    
+    mEnvelopes = {};
+    mEnvelopeScratch = {};
+    mPendingGrains = {};
+    mWindow = {};
+    mWindowLength = 0;
+    
+    mPlayheads = {};
+    mNumActivePlayheads = 0;
+    mNumPendingGrains = 0;
+    mRingPosition = 0;
+}
+
+template <typename SampleType>
+void OverlapAddEngine<SampleType>::reset()
+{
+    // only sounding playheads have anything in their rings
+    for (int i = 0; i < mMaxPlayheads; ++i)
+    {
+        auto& playhead = mPlayheads[static_cast<size_t>(i)];
+        
+        if (playhead.samplesRemaining > 0)
+            for (int channel = 0; channel < 2; ++channel)
+                juce::FloatVectorOperations::clear(getEnvelope(i, channel), mRingSize);
+        
+        playhead = {};
+    }
+    
+    mNumActivePlayheads = 0;
+    mNumPendingGrains = 0;
+    mRingPosition = 0;
+}
+
+//==============================================================================
+template <typename SampleType>
+bool OverlapAddEngine<SampleType>::addGrain(int onset, FixedPoint::Phase startPhase, FixedPoint::Phase increment, int length,
+                                            GrainWindow::Shape shape, float panLeft, float panRight)
+{
+    if (length > mMaxGrainLength || onset >= mMaxBlockSize || mNumPendingGrains >= static_cast<int>(mPendingGrains.size()))
+        return false;
+    
+    if (shape != mWindowShape || length != mWindowLength)
+    {
+        // grain settings only change between blocks, so this never splits a segment's grains
+        if (mNumPendingGrains > 0)
+            return false;
+        
+        setWindow(shape, length);
+    }
+    
+    int nearest = -1;
+    int free = -1;
+    double nearestError = std::numeric_limits<double>::max();
+    
+    for (int i = 0; i < mMaxPlayheads; ++i)
+    {
+        const auto& playhead = mPlayheads[static_cast<size_t>(i)];
+        
+        if (playhead.samplesRemaining <= 0)
+        {
+            if (free < 0)
+                free = i;
+            
+            continue;
+        }
+        
+        if (onset >= playhead.samplesOpen)
+            continue;
+        
+        // where the playhead will be at the grain's start and end, against the grain
+        const auto playheadPhase = playhead.readPhase + static_cast<FixedPoint::Phase>(onset - playhead.startOffset) * playhead.increment;
+        const auto lengthFrames = static_cast<FixedPoint::Phase>(length);
+        const double startError = std::abs(toFrames(playheadPhase - startPhase));
+        const double endError = std::abs(toFrames((playheadPhase + lengthFrames * playhead.increment) - (startPhase + lengthFrames * increment)));
+        const double error = juce::jmax(startError, endError);
+        
+        if (error < nearestError)
+        {
+            nearestError = error;
+            nearest = i;
+        }
+    }
+    
+    int index = nearest;
+    
+    // nothing it can join exactly and nowhere to open a playhead: the time domain's
+    if (nearestError > mJoinTolerance)
+    {
+        if (free < 0)
+            return false;
+        
+        auto& playhead = mPlayheads[static_cast<size_t>(free)];
+        playhead = {};
+        playhead.readPhase = startPhase;
+        playhead.increment = increment;
+        playhead.startOffset = onset;
+        playhead.samplesOpen = onset + length;
+            
+        index = free;
+        ++mNumActivePlayheads;
+    }
+    
+    auto& playhead = mPlayheads[static_cast<size_t>(index)];
+    playhead.samplesRemaining = juce::jmax(playhead.samplesRemaining, onset + length);
+    ++playhead.numPending;
+    
+    mPendingGrains[static_cast<size_t>(mNumPendingGrains++)] = { index, onset, panLeft, panRight };
+    return true;
+}
+
+template <typename SampleType>
+void OverlapAddEngine<SampleType>::render(GrainSource& source, Interpolation::Mode mode, juce::AudioBuffer<SampleType>& output, int bufferOffset, int numSamples,
+                                          juce::AudioBuffer<SampleType>& scratch, juce::AudioBuffer<SampleType>& workspace)
+{
+    jassert(numSamples <= mMaxBlockSize);
+    
+    // this segment's grains go into their playheads' envelopes first
+    if (mNumPendingGrains > 0)
+    {
+        for (int i = 0; i < mMaxPlayheads; ++i)
+        {
+            auto& playhead = mPlayheads[static_cast<size_t>(i)];
+            
+            if (playhead.numPending == 0)
+                continue;
+                
+            accumulate(i);
+            playhead.numPending = 0;
+        }
+        
+        mNumPendingGrains = 0;
+    }
+    
+    const int numOutputChannels = output.getNumChannels();
+    const int numReadChannels = juce::jmin(source.getNumChannels(), scratch.getNumChannels());
+    const int scratchSize = juce::jmin(scratch.getNumSamples(), mMaxBlockSize);
+    const int mask = mRingSize - 1;
+    auto* const* reads = scratch.getArrayOfWritePointers();
+    
+    for (int i = 0; i < mMaxPlayheads; ++i)
+    {
+        auto& playhead = mPlayheads[static_cast<size_t>(i)];
+        
+        if (playhead.samplesRemaining <= 0)
+            continue;
+        
+        const int end = juce::jmin(numSamples, playhead.samplesRemaining);
+        auto readPhase = playhead.readPhase;
+        
+        for (int offset = playhead.startOffset; offset < end; offset += scratchSize)
+        {
+            const int chunk = juce::jmin(scratchSize, end - offset);
+            
+            // one read for every grain on the playhead
+            readPhase = source.readBlock(mode, reads, numReadChannels, chunk, readPhase, playhead.increment, workspace);
+            
+            // the ring wraps at most once in a chunk
+            for (int done = 0; done < chunk;)
+            {
+                const int ringIndex = (mRingPosition + offset + done) & mask;
+                const int span = juce::jmin(chunk - done, mRingSize - ringIndex);
+                
+                // a mono source feeds every output channel; channels past the first take the right gain
+                for (int channel = 0; channel < numOutputChannels; ++channel)
+                    addWithEnvelope(output.getWritePointer(channel, bufferOffset + offset + done), reads[juce::jmin(channel, numReadChannels - 1)] + done,
+                                    getEnvelope(i, juce::jmin(channel, 1)) + ringIndex, mEnvelopeScratch.data(), span);
+                    
+                for (int channel = 0; channel < 2; ++channel)
+                    juce::FloatVectorOperations::clear(getEnvelope(i, channel) + ringIndex, span);
+                
+                done += span;
+            }
+        }
+        
+        playhead.readPhase = readPhase;
+        playhead.startOffset = 0;
+        playhead.samplesOpen -= numSamples;
+        playhead.samplesRemaining -= numSamples;
+        
+        if (playhead.samplesRemaining <= 0)
+        {
+            playhead.samplesRemaining = 0;
+            --mNumActivePlayheads;
+        }
+    }
+    
+    mRingPosition = (mRingPosition + numSamples) & mask;
+}
+
+//==============================================================================
+template <typename SampleType>
+void OverlapAddEngine<SampleType>::setWindow(GrainWindow::Shape shape, int length)
+{
+    GrainWindow::render(GrainWindow::getTable(shape), mWindow.data(), length, 0.0f, 1.0f / static_cast<float>(length));
+    
+    mWindowShape = shape;
+    mWindowLength = length;
+}
+
+template <typename SampleType>
+void OverlapAddEngine<SampleType>::accumulate(int playheadIndex)
+{
+    for (int i = 0; i < mNumPendingGrains; ++i)
+    {
+        const auto& grain = mPendingGrains[static_cast<size_t>(i)];
+        
+        if (grain.playhead != playheadIndex)
+            continue;
+        
+        addToRing(getEnvelope(playheadIndex, 0), grain.onset, mWindow.data(), grain.panLeft, mWindowLength);
+        addToRing(getEnvelope(playheadIndex, 1), grain.onset, mWindow.data(), grain.panRight, mWindowLength);
+    }
+}
+
+template <typename SampleType>
+void OverlapAddEngine<SampleType>::addToRing(float* envelope, int offset, const float* source, float gain, int numSamples) noexcept
+{
+    for (int done = 0; done < numSamples;)
+    {
+        const int ringIndex = (mRingPosition + offset + done) & (mRingSize - 1);
+        const int span = juce::jmin(numSamples - done, mRingSize - ringIndex);
+        
+        juce::FloatVectorOperations::addWithMultiply(envelope + ringIndex, source + done, gain, span);
+        done += span;
+    }
+}
+
+//==============================================================================
+template class OverlapAddEngine<float>;
+template class OverlapAddEngine<double>;
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "FixedPoint.h"
+#include "GrainSource.h"
+#include "GrainWindow.h"
+#include "Interpolation.h"
+
+//==============================================================================
+// The Overlap-Add synthesis mode, for clouds too dense to render grain by grain.
+//
+// A grain isn't read on its own. It joins a playhead: one continuous read of the
+// source at the grain's rate, whose phase at the grain's onset is the grain's start.
+// All the grain adds is its window, panned, to the playhead's envelope, and the
+// playhead reads the source once and multiplies it by the summed envelope. A playhead
+// carrying a hundred grains costs one interpolated read instead of a hundred.
+//
+// Each grain's window is added straight into its playhead's envelope. Convolving a
+// segment's onsets with the window through an FFT would cost two transforms of a block
+// plus a grain, which only pays off with around a hundred grains on one playhead in one
+// block; at the densities the plugin reaches a playhead gets a handful, so there is no
+// FFT path.
+//
+// The engine only ever takes grains it renders exactly: a grain joins a playhead whose
+// reads at the grain's start and end are its own to within mJoinTolerance, or opens a
+// free one. Anything else (more distinct starts than playheads) is refused and the
+// voice renders it in the time domain. Spray and pitch spray give almost every grain
+// a start of its own, so voices keep the time domain for those settings altogether.
+// The benchmark's regression mode checks the mode against the time domain.
+//
+// One per voice. Storage is only allocated while the mode is in use.
+template <typename SampleType>
+class OverlapAddEngine
+{
+public:
+    OverlapAddEngine() = default;
+    
+    // not while rendering; sizes everything for segments of up to maxBlockSize samples
+    void prepare(double sampleRate, int maxBlockSize);
+    
+    // frees the storage; addGrain() refuses every grain until the next prepare
+    void release();
+    
+    bool isPrepared() const noexcept { return mMaxGrainLength > 0; }
+    
+    // longest grain addGrain() takes, in samples; 0 until prepared
+    int getMaxGrainLength() const noexcept { return mMaxGrainLength; }
+    
+    // drops every playhead and pending grain
+    void reset();
+    
+    // Adds a grain sounding from onset samples into the segment about to be rendered.
+    // Returns false if the engine can't take it (not prepared, grain too long, or no
+    // playhead that reads what it would and none free); the caller then renders it in
+    // the time domain.
+    bool addGrain(int onset, FixedPoint::Phase startPhase, FixedPoint::Phase increment, int length,
+                  GrainWindow::Shape shape, float panLeft, float panRight);
+    
+    // adds numSamples of every playhead to output from bufferOffset, including the grains
+    // added since the last call; scratch and workspace are the voice's own
+    void render(GrainSource& source, Interpolation::Mode mode, juce::AudioBuffer<SampleType>& output, int bufferOffset, int numSamples,
+                juce::AudioBuffer<SampleType>& scratch, juce::AudioBuffer<SampleType>& workspace);
+    
+    bool isActive() const noexcept { return mNumActivePlayheads > 0; }
+    int getNumActivePlayheads() const noexcept { return mNumActivePlayheads; }
+    
+    // calls function(readPhase, level) for every sounding playhead, for drawing
+    template <typename Function>
+    void visitPlayheads(Function&& function) const
+    {
+        for (int i = 0; i < mMaxPlayheads; ++i)
+        {
+            const auto& playhead = mPlayheads[static_cast<size_t>(i)];
+            
+            if (playhead.samplesRemaining > 0)
+                function(playhead.readPhase, juce::jmax(getLevel(i, 0, mRingPosition), getLevel(i, 1, mRingPosition)));
+        }
+    }
+    
+    static constexpr int mMaxPlayheads { 8 };
+    
+    // longer grains are left to the time domain: every playhead's envelope has to hold
+    // a grain's length ahead, and dense clouds use short grains anyway
+    static constexpr double mMaxGrainSeconds { 0.25 };
+
+private:
+    //==============================================================================
+    struct Playhead
+    {
+        FixedPoint::Phase readPhase { 0 };                  // at startOffset into the coming segment
+        FixedPoint::Phase increment { FixedPoint::one };
+        int startOffset { 0 };
+        int samplesRemaining { 0 };     // from the coming segment's start to its last grain's end; 0 when free
+        int samplesOpen { 0 };          // grains with an onset before this may join
+        int numPending { 0 };
+    };
+    
+    struct PendingGrain
+    {
+        int playhead { 0 };
+        int onset { 0 };
+        float panLeft { 1.0f };
+        float panRight { 1.0f };
+    };
+    
+    void setWindow(GrainWindow::Shape shape, int length);
+    void accumulate(int playheadIndex);
+    void addToRing(float* envelope, int offset, const float* source, float gain, int numSamples) noexcept;
+    
+    float* getEnvelope(int playheadIndex, int channel) noexcept
+    {
+        return mEnvelopes.data() + static_cast<size_t>((playheadIndex * 2 + channel) * mRingSize);
+    }
+    
+    const float* getEnvelope(int playheadIndex, int channel) const noexcept
+    {
+        return mEnvelopes.data() + static_cast<size_t>((playheadIndex * 2 + channel) * mRingSize);
+    }
+    
+    float getLevel(int playheadIndex, int channel, int ringIndex) const noexcept { return getEnvelope(playheadIndex, channel)[ringIndex]; }
+    
+    //==============================================================================
+    std::array<Playhead, mMaxPlayheads> mPlayheads;
+    int mNumActivePlayheads { 0 };
+    
+    // this segment's grains; a segment never holds more than one per sample
+    std::vector<PendingGrain> mPendingGrains;
+    int mNumPendingGrains { 0 };
+    
+    // left and right envelopes per playhead, as rings of a power-of-two size; mRingPosition is the coming segment's first sample. Played
+    // samples are cleared, so a ring is all zeros beyond its playhead's last grain
+    std::vector<float> mEnvelopes;
+    int mRingSize { 0 };
+    int mRingPosition { 0 };
+    
+    // the envelope widened to double, for the double-precision engine only
+    std::vector<SampleType> mEnvelopeScratch;
+    
+    // every grain in a segment shares one window
+    std::vector<float> mWindow;
+    GrainWindow::Shape mWindowShape { GrainWindow::Shape::hann };
+    int mWindowLength { 0 };
+    
+    int mMaxGrainLength { 0 };
+    int mMaxBlockSize { 0 };
+    
+    // frames a grain may be from a playhead (start error plus drift over its length) and
+    // still join it: phase rounding, far below anything audible
+    static constexpr double mJoinTolerance { 1.0 / 4096.0 };
+};
@@ -0,0 +1,177 @@
+#include "PerformanceTelemetry.h"
+
+//==============================================================================
+PerformanceTelemetry::PerformanceTelemetry()
+    : juce::Thread("Performance telemetry")
+{
+    mRing.resize(static_cast<size_t>(mRingSize));
+}
+
+PerformanceTelemetry::~PerformanceTelemetry()
+{
+    stopThread(1000);
+    stopLogging();
+}
+
+void PerformanceTelemetry::prepare()
+{
+    if (! isThreadRunning())
+        startThread(juce::Thread::Priority::low);
+}
+
+void PerformanceTelemetry::push(const BlockRecord& record) noexcept
+{
+    const auto samplePosition = mNextSamplePosition;
+    mNextSamplePosition += record.numSamples;
+    
+    const auto scope = mFifo.write(1);
+    
+    if (scope.blockSize1 + scope.blockSize2 == 0)
+    {
+        mNumDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    
+    auto& slot = mRing[static_cast<size_t>(scope.blockSize1 > 0 ? scope.startIndex1 : scope.startIndex2)];
+    slot = record;
+    slot.samplePosition = samplePosition;
+}
+
+//==============================================================================
+void PerformanceTelemetry::run()
+{
+    while (! threadShouldExit())
+    {
+        drain();
+        wait(mDrainIntervalMs);
+    }
+    
+    drain();
+}
+
+void PerformanceTelemetry::drain()
+{
+    const auto scope = mFifo.read(mFifo.getNumReady());
+    
+    const auto process = [this] (int start, int size)
+    {
+        for (int i = start; i < start + size; ++i)
+        {
+            const auto& record = mRing[static_cast<size_t>(i)];
+            
+            addToSummary(record);
+            writeToLog(record);
+        }
+    };
+    
+    process(scope.startIndex1, scope.blockSize1);
+    process(scope.startIndex2, scope.blockSize2);
+    
+    const juce::ScopedLock lock(mSummaryLock);
+    mSummary.numDropped = mNumDropped.load(std::memory_order_relaxed);
+}
+
+void PerformanceTelemetry::addToSummary(const BlockRecord& record)
+{
+    const double load = record.budgetSeconds > 0.0f ? static_cast<double>(record.renderSeconds / record.budgetSeconds) : 0.0;
+    const int loadBucket = juce::jlimit(0, mNumLoadBuckets - 1, static_cast<int>(load * 10.0));
+    const int grainBucket = juce::jlimit(0, mNumGrainBuckets - 1, record.numActiveGrains / 64);
+    
+    const juce::ScopedLock lock(mSummaryLock);
+    
+    ++mSummary.numBlocks;
+    mSummary.numSteals += record.numSteals;
+    mSummary.totalLoad += load;
+    mSummary.worstBlockSeconds = juce::jmax(mSummary.worstBlockSeconds, static_cast<double>(record.renderSeconds));
+    mSummary.worstLoad = juce::jmax(mSummary.worstLoad, load);
+    mSummary.lastRecord = record;
+    
+    if (record.renderSeconds > record.budgetSeconds)
+        ++mSummary.numDeadlineMisses;
+    
+    ++mSummary.loadHistogram[static_cast<size_t>(loadBucket)];
+    ++mSummary.grainHistogram[static_cast<size_t>(grainBucket)];
+}
+
+PerformanceTelemetry::Summary PerformanceTelemetry::getSummary() const
+{
+    const juce::ScopedLock lock(mSummaryLock);
+    return mSummary;
+}
+
+void PerformanceTelemetry::resetSummary()
+{
+    const juce::ScopedLock lock(mSummaryLock);
+    mSummary = {};
+    mNumDropped.store(0, std::memory_order_relaxed);
+}
+
+//==============================================================================
+bool PerformanceTelemetry::startLogging(const juce::File& file)
+{
+    auto stream = std::make_unique<juce::FileOutputStream>(file);
+    
+    if (! stream->openedOk())
+        return false;
+    
+    stream->setPosition(0);
+    stream->truncate();
+    
+    const bool asJson = file.hasFileExtension(".json");
+    
+    // JSON is written one object per line, so a log cut short still parses line by line
+    if (! asJson)
+        stream->writeText("sample,render_ms,budget_ms,load,voices,grains,steals,governor_level\n", false, false, nullptr);
+    
+    const juce::ScopedLock lock(mLogLock);
+    mLogStream = std::move(stream);
+    mLogAsJson = asJson;
+    
+    return true;
+}
+
+void PerformanceTelemetry::stopLogging()
+{
+    const juce::ScopedLock lock(mLogLock);
+    
+    if (mLogStream != nullptr)
+        mLogStream->flush();
+    
+    mLogStream.reset();
+}
+
+bool PerformanceTelemetry::isLogging() const
+{
+    const juce::ScopedLock lock(mLogLock);
+    return mLogStream != nullptr;
+}
+
+void PerformanceTelemetry::writeToLog(const BlockRecord& record)
+{
+    const juce::ScopedLock lock(mLogLock);
+    
+    if (mLogStream == nullptr)
+        return;
+    
+    const double renderMs = 1000.0 * record.renderSeconds;
+    const double budgetMs = 1000.0 * record.budgetSeconds;
+    const double load = budgetMs > 0.0 ? renderMs / budgetMs : 0.0;
+    
+    juce::String line;
+    
+    if (mLogAsJson)
+        line << "{\"sample\":" << record.samplePosition
+             << ",\"render_ms\":" << juce::String(renderMs, 4)
+             << ",\"budget_ms\":" << juce::String(budgetMs, 4)
+             << ",\"load\":" << juce::String(load, 4)
+             << ",\"voices\":" << record.numActiveVoices
+             << ",\"grains\":" << record.numActiveGrains
+             << ",\"steals\":" << record.numSteals
+             << ",\"governor_level\":" << record.governorLevel << "}\n";
+    else
+        line << record.samplePosition << ',' << juce::String(renderMs, 4) << ',' << juce::String(budgetMs, 4) << ','
+             << juce::String(load, 4) << ',' << record.numActiveVoices << ',' << record.numActiveGrains << ','
+             << record.numSteals << ',' << record.governorLevel << '\n';
+    
+    mLogStream->writeText(line, false, false, nullptr);
+}
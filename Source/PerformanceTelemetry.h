@@ -0,0 +1,86 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+// Per-block performance records from the audio thread, aggregated in the background.
+//
+// The audio thread pushes one BlockRecord per processBlock into a preallocated
+// single-producer ring (juce::AbstractFifo); a full ring drops the record and counts
+// it, so pushing never blocks or allocates. A background thread drains the ring a few
+// times a second, folds the records into a Summary (totals, worst block, histograms)
+// and, while logging is on, appends each record to a CSV file (or JSON lines when the
+// file ends in .json). The editor reads copies of the Summary.
+class PerformanceTelemetry : private juce::Thread
+{
+public:
+    struct BlockRecord
+    {
+        juce::int64 samplePosition { 0 };   // filled in by push()
+        float renderSeconds { 0.0f };
+        float budgetSeconds { 0.0f };
+        int numActiveVoices { 0 };
+        int numActiveGrains { 0 };
+        int numSteals { 0 };
+        int governorLevel { 0 };
+        int numSamples { 0 };
+    };
+    
+    static constexpr int mNumLoadBuckets { 16 };    // 10% of the budget each, the last one open-ended
+    static constexpr int mNumGrainBuckets { 16 };   // 64 grains each, the last one open-ended
+    
+    struct Summary
+    {
+        juce::int64 numBlocks { 0 };
+        juce::int64 numDeadlineMisses { 0 };
+        juce::int64 numSteals { 0 };
+        juce::int64 numDropped { 0 };       // records lost to a full ring
+        double worstBlockSeconds { 0.0 };
+        double worstLoad { 0.0 };
+        double totalLoad { 0.0 };           // sum of per-block loads; / numBlocks for the mean
+        BlockRecord lastRecord;
+        std::array<juce::int64, mNumLoadBuckets> loadHistogram {};
+        std::array<juce::int64, mNumGrainBuckets> grainHistogram {};
+    };
+    
+    PerformanceTelemetry();
+    ~PerformanceTelemetry() override;
+    
+    // message thread; starts the aggregation thread if it isn't running yet
+    void prepare();
+    
+    // audio thread only
+    void push(const BlockRecord& record) noexcept;
+    
+    // any thread but the audio thread
+    Summary getSummary() const;
+    void resetSummary();
+    
+    bool startLogging(const juce::File& file);
+    void stopLogging();
+    bool isLogging() const;
+
+private:
+    //==============================================================================
+    void run() override;
+    void drain();
+    void addToSummary(const BlockRecord& record);
+    void writeToLog(const BlockRecord& record);
+    
+    static constexpr int mRingSize { 4096 };        // about 40 s of 512-sample blocks at 48 kHz
+    static constexpr int mDrainIntervalMs { 50 };
+    
+    juce::AbstractFifo mFifo { mRingSize };
+    std::vector<BlockRecord> mRing;
+    std::atomic<juce::int64> mNumDropped { 0 };
+    juce::int64 mNextSamplePosition { 0 };
+    
+    mutable juce::CriticalSection mSummaryLock;
+    Summary mSummary;
+    
+    mutable juce::CriticalSection mLogLock;
+    std::unique_ptr<juce::FileOutputStream> mLogStream;
+    bool mLogAsJson { false };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PerformanceTelemetry)
+};
@@ -13,9 +13,22 @@
 LiveGranularSynthAudioProcessorEditor::LiveGranularSynthAudioProcessorEditor (LiveGranularSynthAudioProcessor& p)
     : AudioProcessorEditor (&p), audioProcessor (p)
 {
+    addAndMakeVisible (mWaveformView);
+
+    mLogButton.onClick = [this] { toggleLogging(); };
+    addAndMakeVisible (mLogButton);
+
+    mResetButton.onClick = [this] { audioProcessor.getTelemetry().resetSummary(); };
+    addAndMakeVisible (mResetButton);
+
+    mLoadSampleButton.onClick = [this] { chooseSampleFile(); };
+    addAndMakeVisible (mLoadSampleButton);
+
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (400, 300);
+    setSize (500, 440);
+
+    startTimerHz (10);
 }
 
 LiveGranularSynthAudioProcessorEditor::~LiveGranularSynthAudioProcessorEditor()
@@ -28,13 +41,110 @@ void LiveGranularSynthAudioProcessorEditor::paint (juce::Graphics& g)
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
 
+    const auto& summary = mTelemetrySummary;
+    const auto& last = summary.lastRecord;
+    const double meanLoad = summary.numBlocks > 0 ? summary.totalLoad / static_cast<double> (summary.numBlocks) : 0.0;
+
+    juce::StringArray lines;
+    lines.add ("Load: " + juce::String (100.0 * audioProcessor.getLoadGovernor().getLoad(), 1) + "%"
+               + "   mean " + juce::String (100.0 * meanLoad, 1) + "%"
+               + "   worst " + juce::String (100.0 * summary.worstLoad, 1) + "%");
+    lines.add ("Worst block: " + juce::String (1000.0 * summary.worstBlockSeconds, 2) + " ms"
+               + "   deadline misses: " + juce::String (summary.numDeadlineMisses));
+    lines.add ("Voices: " + juce::String (last.numActiveVoices)
+               + "   grains: " + juce::String (last.numActiveGrains)
+               + "   steals: " + juce::String (summary.numSteals));
+    lines.add ("Governor level: " + juce::String (last.governorLevel)
+               + "   blocks: " + juce::String (summary.numBlocks)
+               + "   dropped: " + juce::String (summary.numDropped));
+
+    auto area = getLocalBounds().reduced (10);
+    area.removeFromTop (waveformHeight + 10);
+    auto textArea = area.removeFromTop (80);
+
     g.setColour (juce::Colours::white);
-    g.setFont (15.0f);
-    g.drawFittedText ("Hello World!", getLocalBounds(), juce::Justification::centred, 1);
+    g.setFont (14.0f);
+
+    for (const auto& line : lines)
+        g.drawText (line, textArea.removeFromTop (20), juce::Justification::centredLeft);
+
+    area.removeFromBottom (30);
+    paintLoadHistogram (g, area.reduced (0, 10));
+}
+
+void LiveGranularSynthAudioProcessorEditor::paintLoadHistogram (juce::Graphics& g, juce::Rectangle<int> area) const
+{
+    const auto& histogram = mTelemetrySummary.loadHistogram;
+    const auto largest = juce::jmax (static_cast<juce::int64> (1), *std::max_element (histogram.begin(), histogram.end()));
+    const int barWidth = area.getWidth() / static_cast<int> (histogram.size());
+
+    for (size_t bucket = 0; bucket < histogram.size(); ++bucket)
+    {
+        const auto height = static_cast<int> (static_cast<double> (area.getHeight()) * static_cast<double> (histogram[bucket]) / static_cast<double> (largest));
+        const juce::Rectangle<int> bar { area.getX() + static_cast<int> (bucket) * barWidth, area.getBottom() - height, barWidth - 1, height };
+
+        // buckets from 100% of the budget up are blocks that missed their deadline
+        g.setColour (bucket >= 10 ? juce::Colours::red : juce::Colours::lightgreen);
+        g.fillRect (bar);
+    }
+
+    g.setColour (juce::Colours::grey);
+    g.drawRect (area);
 }
 
 void LiveGranularSynthAudioProcessorEditor::resized()
 {
-    // This is generally where you'll want to lay out the positions of any
-    // subcomponents in your editor..
+    auto area = getLocalBounds().reduced (10);
+    mWaveformView.setBounds (area.removeFromTop (waveformHeight));
+
+    auto buttons = area.removeFromBottom (24);
+
+    mLogButton.setBounds (buttons.removeFromLeft (120));
+    mResetButton.setBounds (buttons.removeFromRight (80));
+    mLoadSampleButton.setBounds (buttons.removeFromRight (110).withTrimmedRight (10));
+}
+
+//==============================================================================
+void LiveGranularSynthAudioProcessorEditor::timerCallback()
+{
+    mTelemetrySummary = audioProcessor.getTelemetry().getSummary();
+    audioProcessor.releaseRetiredBuffers();
+    repaint();
+}
+
+void LiveGranularSynthAudioProcessorEditor::chooseSampleFile()
+{
+    const auto startDirectory = audioProcessor.getSampleFile().existsAsFile() ? audioProcessor.getSampleFile().getParentDirectory()
+                                                                              : juce::File::getSpecialLocation (juce::File::userMusicDirectory);
+
+    mFileChooser = std::make_unique<juce::FileChooser> ("Load a sample for the Sample File source", startDirectory, "*.wav;*.aif;*.aiff");
+
+    mFileChooser->launchAsync (juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                               [this] (const juce::FileChooser& chooser)
+                               {
+                                   const auto file = chooser.getResult();
+
+                                   if (file != juce::File() && ! audioProcessor.loadSampleFile (file))
+                                       juce::AlertWindow::showMessageBoxAsync (juce::MessageBoxIconType::WarningIcon, "Load sample",
+                                                                               "Couldn't map " + file.getFileName()
+                                                                               + ". Only uncompressed WAV and AIFF files with up to "
+                                                                               + juce::String (MappedFileSource::mMaxChannels) + " channels can be used.");
+                               });
+}
+
+void LiveGranularSynthAudioProcessorEditor::toggleLogging()
+{
+    auto& telemetry = audioProcessor.getTelemetry();
+
+    if (! mLogButton.getToggleState())
+    {
+        telemetry.stopLogging();
+        return;
+    }
+
+    const auto name = "LiveGranularSynth telemetry " + juce::Time::getCurrentTime().formatted ("%Y-%m-%d %H-%M-%S") + ".csv";
+    const auto file = juce::File::getSpecialLocation (juce::File::userDocumentsDirectory).getChildFile (name);
+
+    if (! telemetry.startLogging (file))
+        mLogButton.setToggleState (false, juce::dontSendNotification);
 }
@@ -10,11 +10,13 @@
 
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
+#include "WaveformView.h"
 
 //==============================================================================
 /**
 */
-class LiveGranularSynthAudioProcessorEditor  : public juce::AudioProcessorEditor
+class LiveGranularSynthAudioProcessorEditor  : public juce::AudioProcessorEditor,
+                                               private juce::Timer
 {
 public:
     LiveGranularSynthAudioProcessorEditor (LiveGranularSynthAudioProcessor&);
@@ -25,9 +27,28 @@ public:
     void resized() override;
 
 private:
+    void timerCallback() override;
+    void toggleLogging();
+    void chooseSampleFile();
+    void paintLoadHistogram (juce::Graphics&, juce::Rectangle<int> area) const;
+
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
     LiveGranularSynthAudioProcessor& audioProcessor;
 
+    static constexpr int waveformHeight { 140 };
+
+    // copied from the telemetry thread a few times a second
+    PerformanceTelemetry::Summary mTelemetrySummary;
+
+    WaveformView mWaveformView { audioProcessor };
+
+    juce::ToggleButton mLogButton { "Log to file" };
+    juce::TextButton mResetButton { "Reset" };
+    juce::TextButton mLoadSampleButton { "Load sample..." };
+
+    // kept alive while the asynchronous dialog is open
+    std::unique_ptr<juce::FileChooser> mFileChooser;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LiveGranularSynthAudioProcessorEditor)
 };
@@ -9,6 +9,7 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 #include "Utilities.h"
+#include "RealtimeSafety.h"
 
 //==============================================================================
 LiveGranularSynthAudioProcessor::LiveGranularSynthAudioProcessor()
@@ -23,15 +24,200 @@ LiveGranularSynthAudioProcessor::LiveGranularSynthAudioProcessor()
                        )
 #endif
 {
-    synth.addSound(new GranularSound());
-    for (int i = 0; i < mNumVoices; ++i)
-        synth.addVoice(new GranularVoice());
+    mGrainSizeParam = mParameters.getRawParameterValue(ParameterIDs::grainSize);
+    mDensityParam = mParameters.getRawParameterValue(ParameterIDs::density);
+    mPositionParam = mParameters.getRawParameterValue(ParameterIDs::position);
+    mSprayParam = mParameters.getRawParameterValue(ParameterIDs::spray);
+    mPitchParam = mParameters.getRawParameterValue(ParameterIDs::pitch);
+    mPitchSprayParam = mParameters.getRawParameterValue(ParameterIDs::pitchSpray);
+    mPanSpreadParam = mParameters.getRawParameterValue(ParameterIDs::panSpread);
+    mAttackParam = mParameters.getRawParameterValue(ParameterIDs::attack);
+    mReleaseParam = mParameters.getRawParameterValue(ParameterIDs::release);
+    mGainParam = mParameters.getRawParameterValue(ParameterIDs::gain);
+    mWindowParam = mParameters.getRawParameterValue(ParameterIDs::window);
+    mInterpolationParam = mParameters.getRawParameterValue(ParameterIDs::interpolation);
+    mSynthesisParam = mParameters.getRawParameterValue(ParameterIDs::synthesis);
+    mParallelRenderingParam = mParameters.getRawParameterValue(ParameterIDs::parallelRendering);
+    mSourceParam = mParameters.getRawParameterValue(ParameterIDs::source);
+    mBufferLengthParam = mParameters.getRawParameterValue(ParameterIDs::bufferLength);
+    mBufferPowerOfTwoParam = mParameters.getRawParameterValue(ParameterIDs::bufferPowerOfTwo);
+    mBufferFormatParam = mParameters.getRawParameterValue(ParameterIDs::bufferFormat);
+    mLoadGovernorParam = mParameters.getRawParameterValue(ParameterIDs::loadGovernor);
+    mLoadLimitParam = mParameters.getRawParameterValue(ParameterIDs::loadLimit);
+    mPolyphonyParam = mParameters.getRawParameterValue(ParameterIDs::polyphony);
     
-    synth.setNoteStealingEnabled(true);
+    // processing starts out in single precision
+    mFloatEngine.synth.setNumVoices(getPolyphony());
+    
+    for (auto* id : { ParameterIDs::grainSize, ParameterIDs::density, ParameterIDs::position,
+                      ParameterIDs::spray, ParameterIDs::pitch, ParameterIDs::pitchSpray, ParameterIDs::panSpread,
+                      ParameterIDs::attack, ParameterIDs::release, ParameterIDs::gain,
+                      ParameterIDs::window, ParameterIDs::interpolation, ParameterIDs::synthesis, ParameterIDs::parallelRendering,
+                      ParameterIDs::source, ParameterIDs::bufferLength, ParameterIDs::bufferPowerOfTwo, ParameterIDs::bufferFormat, ParameterIDs::loadGovernor, ParameterIDs::loadLimit,
+                      ParameterIDs::polyphony })
+        mParameters.addParameterListener(id, this);
 }
 
 LiveGranularSynthAudioProcessor::~LiveGranularSynthAudioProcessor()
 {
+    for (auto* id : { ParameterIDs::grainSize, ParameterIDs::density, ParameterIDs::position,
+                      ParameterIDs::spray, ParameterIDs::pitch, ParameterIDs::pitchSpray, ParameterIDs::panSpread,
+                      ParameterIDs::attack, ParameterIDs::release, ParameterIDs::gain,
+                      ParameterIDs::window, ParameterIDs::interpolation, ParameterIDs::synthesis, ParameterIDs::parallelRendering,
+                      ParameterIDs::source, ParameterIDs::bufferLength, ParameterIDs::bufferPowerOfTwo, ParameterIDs::bufferFormat, ParameterIDs::loadGovernor, ParameterIDs::loadLimit,
+                      ParameterIDs::polyphony })
+        mParameters.removeParameterListener(id, this);
+}
+
+//==============================================================================
+juce::AudioProcessorValueTreeState::ParameterLayout LiveGranularSynthAudioProcessor::createParameterLayout()
+{
+    std::vector<std::unique_ptr<juce::RangedAudioParameter>> params;
+    
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::grainSize, 1 }, "Grain Size",
+                                                                 juce::NormalisableRange<float> { 5.0f, 1000.0f, 0.1f, 0.4f }, 100.0f, "ms"));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::density, 1 }, "Density",
+                                                                 juce::NormalisableRange<float> { 0.5f, 2000.0f, 0.01f, 0.3f }, 20.0f, "grains/s"));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::position, 1 }, "Position",
+                                                                 juce::NormalisableRange<float> { 0.0f, 1.0f }, 0.0f));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::spray, 1 }, "Spray",
+                                                                 juce::NormalisableRange<float> { 0.0f, 1000.0f, 0.1f, 0.4f }, 0.0f, "ms"));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::pitch, 1 }, "Pitch",
+                                                                 juce::NormalisableRange<float> { -24.0f, 24.0f, 0.01f }, 0.0f, "st"));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::pitchSpray, 1 }, "Pitch Spray",
+                                                                 juce::NormalisableRange<float> { 0.0f, 12.0f, 0.01f, 0.5f }, 0.0f, "st"));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::panSpread, 1 }, "Pan Spread",
+                                                                 juce::NormalisableRange<float> { 0.0f, 1.0f }, 0.0f));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::attack, 1 }, "Attack",
+                                                                 juce::NormalisableRange<float> { 0.0f, 5000.0f, 0.1f, 0.3f }, 50.0f, "ms"));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::release, 1 }, "Release",
+                                                                 juce::NormalisableRange<float> { 0.0f, 5000.0f, 0.1f, 0.3f }, 50.0f, "ms"));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::gain, 1 }, "Gain",
+                                                                 juce::NormalisableRange<float> { -60.0f, 12.0f, 0.1f }, -20.0f, "dB"));
+    
+    // choice order matches GrainWindow::Shape
+    params.push_back(std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { ParameterIDs::window, 1 }, "Window",
+                                                                  juce::StringArray { "Hann", "Tukey", "Gaussian", "Trapezoid", "Exp Decay" }, 0));
+    
+    // choice order matches Interpolation::Mode; Auto trades quality for grain count
+    params.push_back(std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { ParameterIDs::interpolation, 1 }, "Interpolation",
+                                                                  juce::StringArray { "Auto", "Linear", "Hermite", "Lagrange", "Sinc" }, 0));
+    
+    // choice order matches GrainSynthesis; Overlap-Add is for dense clouds of short grains,
+    // and only allocates its storage while selected. It always matches Time Domain: with
+    // spray or pitch spray, or more distinct starts than playheads, grains fall back to
+    // the time domain (see OverlapAddEngine)
+    params.push_back(std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { ParameterIDs::synthesis, 1 }, "Synthesis",
+                                                                  juce::StringArray { "Time Domain", "Overlap-Add" }, 0));
+    
+    // renders voices on worker threads; the output is identical either way
+    params.push_back(std::make_unique<juce::AudioParameterBool>(juce::ParameterID { ParameterIDs::parallelRendering, 1 }, "Multi-threaded", false));
+    
+    // voices are allocated in prepareToPlay; raising this while playing is capped at
+    // what was allocated until the next prepare
+    params.push_back(std::make_unique<juce::AudioParameterInt>(juce::ParameterID { ParameterIDs::polyphony, 1 }, "Polyphony", 1, 512, 16));
+    
+    // Sample File falls back to the live input until a file has been loaded
+    params.push_back(std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { ParameterIDs::source, 1 }, "Source",
+                                                                  juce::StringArray { "Live Input", "Sample File" }, 0));
+    
+    // how much live input grains can reach back into, whatever the sample rate
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::bufferLength, 1 }, "Buffer Length",
+                                                                 juce::NormalisableRange<float> { 0.25f, 300.0f, 0.01f, 0.3f }, 1.0f, "s"));
+    
+    // rounds the buffer up to a power of two, so grain phases wrap with a mask; costs up
+    // to twice the memory
+    params.push_back(std::make_unique<juce::AudioParameterBool>(juce::ParameterID { ParameterIDs::bufferPowerOfTwo, 1 }, "Power-of-2 Buffer", false));
+    
+    // the 16-bit formats halve the buffer's memory and bandwidth, for long buffers
+    params.push_back(std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { ParameterIDs::bufferFormat, 1 }, "Buffer Format",
+                                                                  juce::StringArray { "32-bit Float", "16-bit Integer", "16-bit Float" }, 0));
+    
+    // share of each block's time budget above which the grain cloud is thinned out
+    params.push_back(std::make_unique<juce::AudioParameterBool>(juce::ParameterID { ParameterIDs::loadGovernor, 1 }, "CPU Governor", true));
+    params.push_back(std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { ParameterIDs::loadLimit, 1 }, "CPU Limit",
+                                                                 juce::NormalisableRange<float> { 25.0f, 100.0f, 1.0f }, 80.0f, "%"));
+    
+    return { params.begin(), params.end() };
+}
+
+void LiveGranularSynthAudioProcessor::parameterChanged (const juce::String& parameterID, float /*newValue*/)
+{
+    // may arrive on any thread; the audio thread picks the new values up on its next block
+    mParameterGeneration.fetch_add(1, std::memory_order_release);
+    
+    // a new buffer length or format, or the Overlap-Add storage, means allocating, which has
+    // to happen on the message thread
+    if (parameterID == ParameterIDs::bufferLength || parameterID == ParameterIDs::bufferPowerOfTwo || parameterID == ParameterIDs::bufferFormat
+        || parameterID == ParameterIDs::synthesis)
+        triggerAsyncUpdate();
+}
+
+void LiveGranularSynthAudioProcessor::handleAsyncUpdate()
+{
+    withActiveEngine([this] (auto& engine)
+    {
+        // also frees whatever buffer the last resize replaced
+        if (getSampleRate() > 0.0)
+            engine.buffer.requestResize(getBufferLengthInSamples(getSampleRate()), getBufferFormat());
+        else
+            engine.buffer.releaseRetiredStorage();
+        
+        const auto& voices = engine.synth.getVoices();
+        const bool overlapAdd = getSynthesis() == GrainSynthesis::overlapAdd;
+        
+        // voices render their Overlap-Add playheads unlocked, so processing stops while
+        // their storage changes; prepareToPlay sizes it otherwise
+        if (getSampleRate() > 0.0 && ! voices.empty() && voices.front()->isOverlapAddPrepared() != overlapAdd)
+        {
+            suspendProcessing(true);
+            
+            for (auto* voice : voices)
+                voice->prepareOverlapAdd(overlapAdd);
+            
+            suspendProcessing(false);
+        }
+    });
+}
+
+void LiveGranularSynthAudioProcessor::releaseRetiredBuffers()
+{
+    // posting a message from the audio thread could lock or allocate, so the message
+    // thread asks instead
+    withActiveEngine([] (auto& engine)
+    {
+        if (engine.buffer.hasRetiredStorage())
+            engine.buffer.releaseRetiredStorage();
+    });
+}
+
+int LiveGranularSynthAudioProcessor::getBufferLengthInSamples(double sampleRate) const
+{
+    // wide inputs at high rates get less than the full Buffer Length, rather than an
+    // allocation of many gigabytes
+    const int maxLength = CircularBuffer<float>::getMaxBufferSize(getTotalNumInputChannels());
+    const int length = juce::jmin(maxLength, juce::roundToInt(static_cast<double>(mBufferLengthParam->load()) * sampleRate));
+    
+    if (mBufferPowerOfTwoParam->load() < 0.5f)
+        return length;
+    
+    const int rounded = juce::nextPowerOfTwo(length);
+    return rounded > maxLength ? rounded / 2 : rounded;
+}
+
+int LiveGranularSynthAudioProcessor::getPolyphony() const
+{
+    return juce::jlimit(1, 512, juce::roundToInt(mPolyphonyParam->load()));
+}
+
+GrainSynthesis LiveGranularSynthAudioProcessor::getSynthesis() const
+{
+    return static_cast<GrainSynthesis>(juce::jlimit(0, 1, static_cast<int>(mSynthesisParam->load())));
+}
+
+SampleFormats::Format LiveGranularSynthAudioProcessor::getBufferFormat() const
+{
+    return static_cast<SampleFormats::Format>(juce::jlimit(0, 2, static_cast<int>(mBufferFormatParam->load())));
 }
 
 //==============================================================================
@@ -98,36 +284,88 @@ void LiveGranularSynthAudioProcessor::changeProgramName (int index, const juce::
 
 //==============================================================================
 void LiveGranularSynthAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+{
+    if (mFileSource != nullptr)
+        mFileSource->prepare(sampleRate);
+    
+    // the precision can only change while stopped, so the idle engine gives its memory back here
+    if (isUsingDoublePrecision())
+    {
+        releaseEngine(mFloatEngine);
+        prepareEngine(mDoubleEngine, sampleRate, samplesPerBlock);
+    }
+    else
+    {
+        releaseEngine(mDoubleEngine);
+        prepareEngine(mFloatEngine, sampleRate, samplesPerBlock);
+    }
+    
+    mTelemetry.prepare();
+}
+
+template <typename SampleType>
+void LiveGranularSynthAudioProcessor::prepareEngine(Engine<SampleType>& engine, double sampleRate, int samplesPerBlock)
 {
     juce::dsp::ProcessSpec spec;
     spec.maximumBlockSize = samplesPerBlock;
     spec.sampleRate = sampleRate;
     spec.numChannels = getTotalNumInputChannels();
     
-    mCircularBuffer.prepare(spec);
+    auto& synth = engine.synth;
+    
+    engine.buffer.prepare(spec, getBufferLengthInSamples(sampleRate), getBufferFormat());
     
-    mReadPosition.resize(getTotalNumInputChannels());
-    std::fill(mReadPosition.begin(), mReadPosition.end(), 0.0f);
+    synth.setNumVoices(getPolyphony());
     
-    synth.setCurrentPlaybackSampleRate(sampleRate);
+    if (mRandomSeed.has_value())
+        synth.setRandomSeed(*mRandomSeed);
     
-    for (int i = 0; i < synth.getNumVoices(); ++i)
+    // leave a core for the host; the audio thread renders voices too
+    synth.setNumWorkerThreads(juce::jmin(synth.getNumVoices() - 1, juce::SystemStats::getNumCpus() - 1), sampleRate, samplesPerBlock);
+    
+    // voices snap their smoothed values to whatever was pushed last
+    pushParametersToVoices(synth);
+    
+    synth.setOutputLayout(getChannelLayoutOfBus(false, 0));
+    
+    for (auto* voice : synth.getVoices())
     {
-        if (auto voice = dynamic_cast<GranularVoice*>(synth.getVoice(i)))
-        {
-            voice->prepareToPlay(sampleRate,
-                                 samplesPerBlock,
-                                 getTotalNumOutputChannels());
-            
-            voice->setReferencedBuffer(mCircularBuffer);
-        }
+        voice->prepareToPlay(sampleRate,
+                             samplesPerBlock,
+                             getTotalNumOutputChannels());
     }
+    
+    synth.allNotesOff();
+    
+    mActiveSource = chooseGrainSource(engine);
+    synth.setGrainSource(mActiveSource);
+    
+    mLoadGovernor.prepare(sampleRate);
+    synth.setLoadLimits(mLoadGovernor.getLimits());
+}
+    
+template <typename SampleType>
+void LiveGranularSynthAudioProcessor::releaseEngine(Engine<SampleType>& engine)
+{
+    engine.synth.setNumWorkerThreads(0);
+    engine.synth.setNumVoices(0);
+    engine.buffer.release();
 }
 
 void LiveGranularSynthAudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    withActiveEngine([] (auto& engine)
+    {
+        engine.synth.setNumWorkerThreads(0);
+    
+        // nothing is rendering now, so the capture buffer can go; prepareToPlay allocates it again
+        engine.buffer.release();
+    });
+    
+    // sources replaced during playback can go too
+    mRetiredFileSources.clear();
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -137,17 +375,18 @@ bool LiveGranularSynthAudioProcessor::isBusesLayoutSupported (const BusesLayout&
     juce::ignoreUnused (layouts);
     return true;
   #else
-    // This is the place where you check if the layout is supported.
-    // In this template code we only support mono or stereo.
-    // Some plugin hosts, such as certain GarageBand versions, will only
-    // load plugins that support stereo bus layouts.
-    if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::mono()
-     && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
+    // grains can be placed in mono, stereo, and the surround, discrete and ambisonic
+    // layouts SpatialPanner has tables for
+    const auto output = layouts.getMainOutputChannelSet();
+    
+    if (! SpatialPanner::isLayoutSupported(output))
         return false;
 
-    // This checks if the input layout matches the output layout
+    // the live input is mono or stereo, or matches the output
    #if ! JucePlugin_IsSynth
-    if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
+    const auto input = layouts.getMainInputChannelSet();
+    
+    if (input != juce::AudioChannelSet::mono() && input != juce::AudioChannelSet::stereo() && input != output)
         return false;
    #endif
 
@@ -157,25 +396,85 @@ bool LiveGranularSynthAudioProcessor::isBusesLayoutSupported (const BusesLayout&
 #endif
 
 void LiveGranularSynthAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer, midiMessages, mFloatEngine);
+}
+
+void LiveGranularSynthAudioProcessor::processBlock (juce::AudioBuffer<double>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer, midiMessages, mDoubleEngine);
+}
+
+bool LiveGranularSynthAudioProcessor::supportsDoublePrecisionProcessing() const
+{
+    return true;
+}
+
+template <typename SampleType>
+void LiveGranularSynthAudioProcessor::process(juce::AudioBuffer<SampleType>& buffer, juce::MidiBuffer& midiMessages, Engine<SampleType>& engine)
 {
     juce::ScopedNoDenormals noDenormals;
+    RealtimeSafety::ScopedRealtimeSection realtimeSection;
+    const auto blockStartTicks = juce::Time::getHighResolutionTicks();
+    mBlockCounter.fetch_add(1, std::memory_order_acq_rel);
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
     
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
     
+    auto& synth = engine.synth;
+    
     for (int channel = 0; channel < totalNumInputChannels; ++channel)
     {
         auto* channelData = buffer.getWritePointer (channel);
 
-        mCircularBuffer.fillNextBlock(channel, buffer.getNumSamples(), channelData);
+        engine.buffer.fillNextBlock(channel, buffer.getNumSamples(), channelData);
     }
     
-    //setParams(); // includes setVoiceParams()
-    updateGrainParams();
+    updateGrainParams(synth);
+    
+    if (auto* source = chooseGrainSource(engine); source != mActiveSource)
+    {
+        mActiveSource = source;
+        synth.setGrainSource(source);
+    }
     
     synth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+    
+    const auto elapsedSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - blockStartTicks);
+    
+    // running late: thin the cloud from the next block on, rather than drop out
+    if (mLoadGovernor.update(elapsedSeconds, buffer.getNumSamples()))
+        synth.setLoadLimits(mLoadGovernor.getLimits());
+    
+    const auto& stats = synth.getLastBlockStats();
+    
+    PerformanceTelemetry::BlockRecord record;
+    record.renderSeconds = static_cast<float>(elapsedSeconds);
+    record.budgetSeconds = static_cast<float>(buffer.getNumSamples() / getSampleRate());
+    record.numActiveVoices = stats.numActiveVoices;
+    record.numActiveGrains = stats.numActiveGrains;
+    record.numSteals = stats.numSteals;
+    record.governorLevel = mLoadGovernor.getLevel();
+    record.numSamples = buffer.getNumSamples();
+    
+    mTelemetry.push(record);
+    
+    // only refilled once the editor has taken the last one
+    if (! mGrainSnapshots.isPublishPending())
+    {
+        synth.fillGrainSnapshot(mGrainSnapshots.getWriteBuffer());
+        mGrainSnapshots.publish();
+    }
+}
+
+void LiveGranularSynthAudioProcessor::readWaveformOverview(WaveformOverview& destination)
+{
+    if (isUsingDoublePrecision())
+        mDoubleEngine.buffer.readOverview(destination);
+    else
+        mFloatEngine.buffer.readOverview(destination);
 }
 
 //==============================================================================
@@ -192,30 +491,115 @@ juce::AudioProcessorEditor* LiveGranularSynthAudioProcessor::createEditor()
 //==============================================================================
 void LiveGranularSynthAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
+    if (auto xml = mParameters.copyState().createXml())
+        copyXmlToBinary(*xml, destData);
 }
 
 void LiveGranularSynthAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
+    // restored values reach the voices through parameterChanged like any other change
+    if (auto xml = getXmlFromBinary(data, sizeInBytes))
+        if (xml->hasTagName(mParameters.state.getType()))
+            mParameters.replaceState(juce::ValueTree::fromXml(*xml));
+    
+    const juce::File sampleFile { mParameters.state.getProperty("sampleFile").toString() };
+    
+    if (sampleFile.existsAsFile() && sampleFile != getSampleFile())
+        loadSampleFile(sampleFile);
+}
+
+//==============================================================================
+bool LiveGranularSynthAudioProcessor::loadSampleFile(const juce::File& file)
+{
+    auto source = MappedFileSource::create(file);
+    
+    if (source == nullptr)
+        return false;
+    
+    // not published yet, so nothing reads it; prepareToPlay sets it up otherwise
+    if (getSampleRate() > 0.0)
+        source->prepare(getSampleRate());
+    
+    freeRetiredFileSources();
+    
+    mFileSourceForAudio.store(source.get(), std::memory_order_release);
+    
+    if (mFileSource != nullptr)
+    {
+        // no grain will start in the old file again, so stop keeping its pages in
+        mFileSource->resetPrefetch();
+        mRetiredFileSources.push_back(std::move(mFileSource));
+        mRetiredAtBlock = mBlockCounter.load(std::memory_order_acquire);
+    }
+    
+    mFileSource = std::move(source);
+    
+    // remembered with the rest of the state, and loaded again by setStateInformation
+    mParameters.state.setProperty("sampleFile", file.getFullPathName(), nullptr);
+    
+    return true;
+}
+
+void LiveGranularSynthAudioProcessor::freeRetiredFileSources()
+{
+    // the audio thread picks its source at the start of a block, so two block starts
+    // after a swap nothing can still be reading the old one
+    if (mBlockCounter.load(std::memory_order_acquire) - mRetiredAtBlock >= 2)
+        mRetiredFileSources.clear();
 }
 
-void LiveGranularSynthAudioProcessor::updateGrainParams()
+template <typename SampleType>
+GrainSource* LiveGranularSynthAudioProcessor::chooseGrainSource(Engine<SampleType>& engine)
 {
-    for (int i = 0; i < synth.getNumVoices(); ++i)
+    auto* fileSource = mFileSourceForAudio.load(std::memory_order_acquire);
+    
+    if (fileSource != nullptr && mSourceParam->load() >= 0.5f)
+        return fileSource;
+    
+    return &engine.liveSource;
+}
+
+template <typename SampleType>
+void LiveGranularSynthAudioProcessor::updateGrainParams(GranularSynthesiser<SampleType>& synth)
+{
+    // nothing moved since the last block: no per-voice work at all
+    if (mParameterGeneration.load(std::memory_order_acquire) == mAppliedGeneration)
+        return;
+    
+    pushParametersToVoices(synth);
+}
+
+template <typename SampleType>
+void LiveGranularSynthAudioProcessor::pushParametersToVoices(GranularSynthesiser<SampleType>& synth)
+{
+    mAppliedGeneration = mParameterGeneration.load(std::memory_order_acquire);
+    
+    GrainParameters params;
+    params.grainSizeMs = mGrainSizeParam->load();
+    params.density = mDensityParam->load();
+    params.position = mPositionParam->load();
+    params.sprayMs = mSprayParam->load();
+    params.pitch = mPitchParam->load();
+    params.pitchSpray = mPitchSprayParam->load();
+    params.panSpread = mPanSpreadParam->load();
+    params.gainDb = mGainParam->load();
+    params.window = static_cast<GrainWindow::Shape>(juce::roundToInt(mWindowParam->load()));
+    params.interpolation = static_cast<Interpolation::Mode>(juce::roundToInt(mInterpolationParam->load()));
+    params.synthesis = getSynthesis();
+    
+    // juce::ADSR takes seconds
+    const float attack = mAttackParam->load() * 0.001f;
+    const float release = mReleaseParam->load() * 0.001f;
+    
+    synth.setParallelRendering(mParallelRenderingParam->load() >= 0.5f);
+    synth.setVoiceLimit(getPolyphony());
+    mLoadGovernor.setEnabled(mLoadGovernorParam->load() >= 0.5f);
+    mLoadGovernor.setThreshold(mLoadLimitParam->load() * 0.01f);
+    
+    for (auto* voice : synth.getVoices())
     {
-        if (auto voice = dynamic_cast<GranularVoice*>(synth.getVoice(i)))
-        {
-            float attack = 50.0f;
-            float release = 50.0f;
-            
-            auto& adsr = voice->getAdsr();
-            
-            adsr.update(attack, 0.0f, 1.0f, release);
-        }
+        voice->getAdsr().update(attack, 0.0f, 1.0f, release);
+        voice->setGrainParameters(params);
     }
 }
 
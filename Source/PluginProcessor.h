@@ -10,12 +10,44 @@
 
 #include <JuceHeader.h>
 #include "CircularBuffer.h"
+#include "GrainSource.h"
+#include "MappedFileSource.h"
 #include "GranularSynth.h"
+#include "LoadGovernor.h"
+#include "PerformanceTelemetry.h"
+
+//==============================================================================
+namespace ParameterIDs
+{
+    inline constexpr const char* grainSize { "grainSize" };
+    inline constexpr const char* density { "density" };
+    inline constexpr const char* position { "position" };
+    inline constexpr const char* spray { "spray" };
+    inline constexpr const char* pitch { "pitch" };
+    inline constexpr const char* pitchSpray { "pitchSpray" };
+    inline constexpr const char* panSpread { "panSpread" };
+    inline constexpr const char* attack { "attack" };
+    inline constexpr const char* release { "release" };
+    inline constexpr const char* gain { "gain" };
+    inline constexpr const char* window { "window" };
+    inline constexpr const char* interpolation { "interpolation" };
+    inline constexpr const char* synthesis { "synthesis" };
+    inline constexpr const char* parallelRendering { "parallelRendering" };
+    inline constexpr const char* source { "source" };
+    inline constexpr const char* bufferLength { "bufferLength" };
+    inline constexpr const char* bufferPowerOfTwo { "bufferPowerOfTwo" };
+    inline constexpr const char* bufferFormat { "bufferFormat" };
+    inline constexpr const char* loadGovernor { "loadGovernor" };
+    inline constexpr const char* loadLimit { "loadLimit" };
+    inline constexpr const char* polyphony { "polyphony" };
+}
 
 //==============================================================================
 /**
 */
-class LiveGranularSynthAudioProcessor  : public juce::AudioProcessor
+class LiveGranularSynthAudioProcessor  : public juce::AudioProcessor,
+                                         private juce::AudioProcessorValueTreeState::Listener,
+                                         private juce::AsyncUpdater
                             #if JucePlugin_Enable_ARA
                              , public juce::AudioProcessorARAExtension
                             #endif
@@ -34,6 +66,8 @@ public:
    #endif
 
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock (juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override;
 
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
@@ -59,19 +93,125 @@ public:
     void setStateInformation (const void* data, int sizeInBytes) override;
     
     //==============================================================================
-    void updateGrainParams();
+    juce::AudioProcessorValueTreeState& getValueTreeState() { return mParameters; }
+    const LoadGovernor& getLoadGovernor() const { return mLoadGovernor; }
+    PerformanceTelemetry& getTelemetry() { return mTelemetry; }
+    
+    // newest snapshots for drawing; one reader thread (the message thread) only. The
+    // overview is copied into the caller's, as a resize or release frees the buffer's own
+    void readWaveformOverview(WaveformOverview& destination);
+    const GrainSnapshot& readGrainSnapshot() { return mGrainSnapshots.read(); }
+    
+    static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
     
+    // message thread; maps the file (without reading it) and offers it to the voices,
+    // which use it while the Source parameter is set to Sample File
+    bool loadSampleFile(const juce::File& file);
+    juce::File getSampleFile() const { return mFileSource != nullptr ? mFileSource->getFile() : juce::File(); }
+
+    // message thread, polled from the editor's timer; frees the capture buffer a finished
+    // resize replaced. Without an editor it waits for the next resize or releaseResources()
+    void releaseRetiredBuffers();
+    
+    // before prepareToPlay; from then on every prepare starts the voices' random spray,
+    // pan and pitch from this seed, so offline renders repeat exactly
+    void setRandomSeed(juce::int64 seed) { mRandomSeed = seed; }
+
 private:
-    static constexpr int mNumChannelsToProcess { 2 };
-    static constexpr int mNumVoices { 16 };
-    juce::Synthesiser synth;
+    //==============================================================================
+    // Everything that runs at the processing precision. The host settles on float or
+    // double before prepareToPlay, and only the matching engine is given voices and a
+    // buffer; the other one sits empty.
+    template <typename SampleType>
+    struct Engine
+    {
+        // sized from the Buffer Length, Power-of-2 Buffer and Buffer Format parameters; resized on the message
+        // thread, swapped in by the audio thread
+        CircularBuffer<SampleType> buffer;
+        LiveGrainSource<SampleType> liveSource { buffer };
+        GranularSynthesiser<SampleType> synth;
+    };
+    
+    template <typename Function>
+    void withActiveEngine(Function&& function)
+    {
+        if (isUsingDoublePrecision())
+            function(mDoubleEngine);
+        else
+            function(mFloatEngine);
+    }
     
     //==============================================================================
-    int mGranBufferLength = 44100;
-    CircularBuffer<float> mCircularBuffer { mGranBufferLength };
+    void parameterChanged (const juce::String& parameterID, float newValue) override;
+    void handleAsyncUpdate() override;
+    
+    template <typename SampleType>
+    void process(juce::AudioBuffer<SampleType>& buffer, juce::MidiBuffer& midiMessages, Engine<SampleType>& engine);
+    template <typename SampleType>
+    void prepareEngine(Engine<SampleType>& engine, double sampleRate, int samplesPerBlock);
+    template <typename SampleType>
+    void releaseEngine(Engine<SampleType>& engine);
+    template <typename SampleType>
+    void updateGrainParams(GranularSynthesiser<SampleType>& synth);
+    template <typename SampleType>
+    void pushParametersToVoices(GranularSynthesiser<SampleType>& synth);
+    template <typename SampleType>
+    GrainSource* chooseGrainSource(Engine<SampleType>& engine);
+    
+    void freeRetiredFileSources();
+    int getBufferLengthInSamples(double sampleRate) const;
+    SampleFormats::Format getBufferFormat() const;
+    int getPolyphony() const;
+    GrainSynthesis getSynthesis() const;
+    
+    Engine<float> mFloatEngine;
+    Engine<double> mDoubleEngine;
+    LoadGovernor mLoadGovernor;
+    PerformanceTelemetry mTelemetry;
+    
+    //==============================================================================
+    juce::AudioProcessorValueTreeState mParameters { *this, nullptr, "Parameters", createParameterLayout() };
+    
+    // bumped by any parameter change; the audio thread only pushes values to the voices
+    // when it differs from the generation it last applied
+    std::atomic<juce::uint32> mParameterGeneration { 1 };
+    juce::uint32 mAppliedGeneration { 0 };
+    
+    std::atomic<float>* mGrainSizeParam { nullptr };
+    std::atomic<float>* mDensityParam { nullptr };
+    std::atomic<float>* mPositionParam { nullptr };
+    std::atomic<float>* mSprayParam { nullptr };
+    std::atomic<float>* mPitchParam { nullptr };
+    std::atomic<float>* mPitchSprayParam { nullptr };
+    std::atomic<float>* mPanSpreadParam { nullptr };
+    std::atomic<float>* mAttackParam { nullptr };
+    std::atomic<float>* mReleaseParam { nullptr };
+    std::atomic<float>* mGainParam { nullptr };
+    std::atomic<float>* mWindowParam { nullptr };
+    std::atomic<float>* mInterpolationParam { nullptr };
+    std::atomic<float>* mSynthesisParam { nullptr };
+    std::atomic<float>* mParallelRenderingParam { nullptr };
+    std::atomic<float>* mSourceParam { nullptr };
+    std::atomic<float>* mBufferLengthParam { nullptr };
+    std::atomic<float>* mBufferPowerOfTwoParam { nullptr };
+    std::atomic<float>* mBufferFormatParam { nullptr };
+    std::atomic<float>* mLoadGovernorParam { nullptr };
+    std::atomic<float>* mLoadLimitParam { nullptr };
+    std::atomic<float>* mPolyphonyParam { nullptr };
+    
+    //==============================================================================
+    // owned by the message thread; the audio thread only sees the pointer, and replaced
+    // sources are kept until it can no longer be reading them
+    std::unique_ptr<MappedFileSource> mFileSource;
+    std::vector<std::unique_ptr<MappedFileSource>> mRetiredFileSources;
+    std::atomic<MappedFileSource*> mFileSourceForAudio { nullptr };
+    std::atomic<juce::uint32> mBlockCounter { 0 };
+    juce::uint32 mRetiredAtBlock { 0 };
+    
+    GrainSource* mActiveSource { nullptr };
+    std::optional<juce::int64> mRandomSeed;
     
-    std::vector<float> mReadPosition { 0.0f, 0.0f };
-    float mPlaybackRate = 1.5f;
+    TripleBuffer<GrainSnapshot> mGrainSnapshots;
     
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LiveGranularSynthAudioProcessor)
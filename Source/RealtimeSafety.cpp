@@ -0,0 +1,83 @@
+#include "RealtimeSafety.h"
+
+#ifndef LIVEGRANULAR_CHECK_REALTIME_ALLOCATIONS
+ #define LIVEGRANULAR_CHECK_REALTIME_ALLOCATIONS 0
+#endif
+
+namespace RealtimeSafety
+{
+    namespace
+    {
+        thread_local int sectionDepth { 0 };
+        std::atomic<juce::int64> numViolations { 0 };
+    }
+    
+    bool isInRealtimeSection() noexcept { return sectionDepth > 0; }
+    
+    juce::int64 getNumViolations() noexcept { return numViolations.load(); }
+    void resetViolations() noexcept { numViolations.store(0); }
+    
+    ScopedRealtimeSection::ScopedRealtimeSection() noexcept { ++sectionDepth; }
+    ScopedRealtimeSection::~ScopedRealtimeSection() noexcept { --sectionDepth; }
+   
+   #if LIVEGRANULAR_CHECK_REALTIME_ALLOCATIONS
+    static void recordAllocation() noexcept
+    {
+        if (sectionDepth > 0)
+            numViolations.fetch_add(1);
+    }
+   #endif
+}
+
+#if LIVEGRANULAR_CHECK_REALTIME_ALLOCATIONS
+//==============================================================================
+// Replacement global allocation functions; only compiled into allocation-checking harnesses
+static void* checkedAllocate(std::size_t size)
+{
+    RealtimeSafety::recordAllocation();
+    
+    if (auto* ptr = std::malloc(size > 0 ? size : 1))
+        return ptr;
+    
+    throw std::bad_alloc();
+}
+
+static void* checkedAllocateAligned(std::size_t size, std::align_val_t alignment)
+{
+    RealtimeSafety::recordAllocation();
+    
+    const auto align = juce::jmax(static_cast<std::size_t>(alignment), sizeof(void*));
+    const auto roundedSize = (juce::jmax(size, static_cast<std::size_t>(1)) + align - 1) / align * align;
+    
+    if (auto* ptr = std::aligned_alloc(align, roundedSize))
+        return ptr;
+    
+    throw std::bad_alloc();
+}
+
+static void checkedFree(void* ptr) noexcept
+{
+    if (ptr != nullptr)
+        RealtimeSafety::recordAllocation();
+    
+    std::free(ptr);
+}
+
+void* operator new (std::size_t size)                                              { return checkedAllocate(size); }
+void* operator new[] (std::size_t size)                                            { return checkedAllocate(size); }
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept              { try { return checkedAllocate(size); } catch (...) { return nullptr; } }
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept            { try { return checkedAllocate(size); } catch (...) { return nullptr; } }
+void* operator new (std::size_t size, std::align_val_t alignment)                  { return checkedAllocateAligned(size, alignment); }
+void* operator new[] (std::size_t size, std::align_val_t alignment)                { return checkedAllocateAligned(size, alignment); }
+
+void operator delete (void* ptr) noexcept                                          { checkedFree(ptr); }
+void operator delete[] (void* ptr) noexcept                                        { checkedFree(ptr); }
+void operator delete (void* ptr, std::size_t) noexcept                             { checkedFree(ptr); }
+void operator delete[] (void* ptr, std::size_t) noexcept                           { checkedFree(ptr); }
+void operator delete (void* ptr, const std::nothrow_t&) noexcept                   { checkedFree(ptr); }
+void operator delete[] (void* ptr, const std::nothrow_t&) noexcept                 { checkedFree(ptr); }
+void operator delete (void* ptr, std::align_val_t) noexcept                        { checkedFree(ptr); }
+void operator delete[] (void* ptr, std::align_val_t) noexcept                      { checkedFree(ptr); }
+void operator delete (void* ptr, std::size_t, std::align_val_t) noexcept           { checkedFree(ptr); }
+void operator delete[] (void* ptr, std::size_t, std::align_val_t) noexcept         { checkedFree(ptr); }
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+// Marks code that must never allocate, lock or otherwise block, i.e. everything
+// reachable from processBlock. A section is entered per thread for the lifetime of
+// a ScopedRealtimeSection.
+//
+// When LIVEGRANULAR_CHECK_REALTIME_ALLOCATIONS=1, RealtimeSafety.cpp replaces the
+// global operator new/delete and counts every call made from inside a section. The
+// plugin itself is built without it; harnesses that want to prove the audio path is
+// allocation-free define it and check getNumViolations() after a stress run.
+namespace RealtimeSafety
+{
+    bool isInRealtimeSection() noexcept;
+    
+    juce::int64 getNumViolations() noexcept;
+    void resetViolations() noexcept;
+    
+    class ScopedRealtimeSection
+    {
+    public:
+        ScopedRealtimeSection() noexcept;
+        ~ScopedRealtimeSection() noexcept;
+    
+    private:
+        JUCE_DECLARE_NON_COPYABLE(ScopedRealtimeSection)
+    };
+}
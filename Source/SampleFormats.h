@@ -0,0 +1,148 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+// Compact formats for the live buffer's samples. Each stored type converts to and from
+// float with a few integer and float operations (no tables; only out-of-range and
+// denormal values take another path), so whole runs of samples convert in tight loops.
+namespace SampleFormats
+{
+    enum class Format
+    {
+        float32,
+        int16,      // full scale is +-1; louder input clips
+        float16     // IEEE half: about 3 decimal digits, headroom to +-65504
+    };
+    
+    //==============================================================================
+    struct Int16
+    {
+        juce::int16 value;
+        
+        static Int16 fromFloat(float sample) noexcept
+        {
+            const float scaled = juce::jlimit(-1.0f, 1.0f, sample) * 32767.0f;
+            return { static_cast<juce::int16>(scaled + (scaled < 0.0f ? -0.5f : 0.5f)) };
+        }
+        
+        operator float() const noexcept { return static_cast<float>(value) * (1.0f / 32767.0f); }
+    };
+    
+    //==============================================================================
+    struct Half
+    {
+        juce::uint16 bits;
+        
+        // rounds to nearest even; out-of-range values become infinities, NaNs stay NaNs
+        static Half fromFloat(float sample) noexcept
+        {
+            constexpr juce::uint32 floatInfinity { 255u << 23 };
+            constexpr juce::uint32 halfOverflow { (127u + 16u) << 23 };
+            constexpr juce::uint32 smallestNormal { 113u << 23 };
+            constexpr juce::uint32 denormalMagic { ((127u - 15u) + (23u - 10u) + 1u) << 23 };
+            
+            auto bitsIn = toBits(sample);
+            const juce::uint32 sign = bitsIn & 0x80000000u;
+            bitsIn ^= sign;
+            
+            juce::uint32 result;
+            
+            if (bitsIn >= halfOverflow)
+            {
+                result = bitsIn > floatInfinity ? 0x7e00u : 0x7c00u;
+            }
+            else if (bitsIn < smallestNormal)
+            {
+                // the FPU does the rounding: adding the magic number leaves the denormal
+                // mantissa in the low bits
+                result = toBits(fromBits(bitsIn) + fromBits(denormalMagic)) - denormalMagic;
+            }
+            else
+            {
+                const juce::uint32 mantissaOdd = (bitsIn >> 13) & 1u;
+                bitsIn += (static_cast<juce::uint32>(15 - 127) << 23) + 0xfffu + mantissaOdd;
+                result = bitsIn >> 13;
+            }
+            
+            return { static_cast<juce::uint16>(result | (sign >> 16)) };
+        }
+        
+        operator float() const noexcept
+        {
+            constexpr juce::uint32 shiftedExponent { 0x7c00u << 13 };
+            constexpr juce::uint32 magic { 113u << 23 };
+            
+            juce::uint32 result = (static_cast<juce::uint32>(bits) & 0x7fffu) << 13;
+            const juce::uint32 exponent = result & shiftedExponent;
+            result += static_cast<juce::uint32>(127 - 15) << 23;
+            
+            if (exponent == shiftedExponent)
+                result += static_cast<juce::uint32>(128 - 16) << 23;            // infinity or NaN
+            else if (exponent == 0)
+                result = toBits(fromBits(result + (1u << 23)) - fromBits(magic)); // denormal
+            
+            return fromBits(result | ((static_cast<juce::uint32>(bits) & 0x8000u) << 16));
+        }
+    
+    private:
+        static juce::uint32 toBits(float value) noexcept
+        {
+            juce::uint32 result;
+            std::memcpy(&result, &value, sizeof(result));
+            return result;
+        }
+        
+        static float fromBits(juce::uint32 value) noexcept
+        {
+            float result;
+            std::memcpy(&result, &value, sizeof(result));
+            return result;
+        }
+    };
+    
+    //==============================================================================
+    template <typename Stored, typename SampleType>
+    void write(Stored* destination, const SampleType* source, int numSamples) noexcept
+    {
+        if constexpr (std::is_same_v<Stored, SampleType>)
+        {
+            juce::FloatVectorOperations::copy(destination, source, numSamples);
+        }
+        else
+        {
+            for (int i = 0; i < numSamples; ++i)
+                destination[i] = Stored::fromFloat(static_cast<float>(source[i]));
+        }
+    }
+    
+    template <typename SampleType, typename Stored>
+    void read(SampleType* destination, const Stored* source, int numSamples) noexcept
+    {
+        if constexpr (std::is_same_v<Stored, SampleType>)
+        {
+            juce::FloatVectorOperations::copy(destination, source, numSamples);
+        }
+        else
+        {
+            for (int i = 0; i < numSamples; ++i)
+                destination[i] = static_cast<SampleType>(static_cast<float>(source[i]));
+        }
+    }
+    
+    // Calls function with a value of the stored type for format, so code that only has
+    // the format at run time still gets a loop per type (float32 stores SampleType):
+    //   dispatch<SampleType>(format, [&] (auto stored) { use<decltype(stored)>(...); })
+    template <typename SampleType, typename Function>
+    decltype(auto) dispatch(Format format, Function&& function)
+    {
+        switch (format)
+        {
+            case Format::int16:     return function(Int16 {});
+            case Format::float16:   return function(Half {});
+            case Format::float32:   break;
+        }
+        
+        return function(SampleType {});
+    }
+}
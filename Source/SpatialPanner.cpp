@@ -0,0 +1,281 @@
+#include "SpatialPanner.h"
+
+namespace
+{
+    // degrees clockwise from the front, or NaN for channels that aren't placed (LFE)
+    double getSpeakerAzimuth(juce::AudioChannelSet::ChannelType type, bool quadraphonic) noexcept
+    {
+        using Type = juce::AudioChannelSet::ChannelType;
+        
+        switch (type)
+        {
+            case Type::centre:              return 0.0;
+            case Type::leftCentre:          return -15.0;
+            case Type::rightCentre:         return 15.0;
+            case Type::left:                return quadraphonic ? -45.0 : -30.0;
+            case Type::right:               return quadraphonic ? 45.0 : 30.0;
+            case Type::wideLeft:            return -60.0;
+            case Type::wideRight:           return 60.0;
+            case Type::leftSurroundSide:    return -90.0;
+            case Type::rightSurroundSide:   return 90.0;
+            case Type::leftSurround:        return quadraphonic ? -135.0 : -110.0;
+            case Type::rightSurround:       return quadraphonic ? 135.0 : 110.0;
+            case Type::leftSurroundRear:    return -150.0;
+            case Type::rightSurroundRear:   return 150.0;
+            case Type::centreSurround:      return 180.0;
+            default:                        return std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+    
+    // SN3D real spherical harmonic in ACN order, on the horizontal plane; azimuth is
+    // counter-clockwise, as ambisonics has it
+    double getHorizontalHarmonic(int acn, double azimuth) noexcept
+    {
+        const double sqrt3over2 = std::sqrt(3.0) * 0.5;
+        const double sqrt5over8 = std::sqrt(5.0 / 8.0);
+        const double sqrt3over8 = std::sqrt(3.0 / 8.0);
+        
+        switch (acn)
+        {
+            case 0:     return 1.0;
+            case 1:     return std::sin(azimuth);
+            case 3:     return std::cos(azimuth);
+            case 4:     return sqrt3over2 * std::sin(2.0 * azimuth);
+            case 6:     return -0.5;
+            case 8:     return sqrt3over2 * std::cos(2.0 * azimuth);
+            case 9:     return sqrt5over8 * std::sin(3.0 * azimuth);
+            case 11:    return -sqrt3over8 * std::sin(azimuth);
+            case 13:    return -sqrt3over8 * std::cos(azimuth);
+            case 15:    return sqrt5over8 * std::cos(3.0 * azimuth);
+            default:    return 0.0;     // the rest only pick up elevation
+        }
+    }
+}
+
+//==============================================================================
+SpatialPanner::SpatialPanner()
+{
+    prepare(juce::AudioChannelSet::stereo());
+}
+
+bool SpatialPanner::isLayoutSupported(const juce::AudioChannelSet& layout)
+{
+    if (layout.isDisabled())
+        return false;
+    
+    if (layout.size() == 1 || layout.size() == 2)
+        return true;
+    
+    const int order = layout.getAmbisonicOrder();
+    
+    if (order >= 1)
+        return order <= mMaxAmbisonicOrder;
+    
+    if (layout.isDiscreteLayout())
+        return layout.size() <= mMaxDiscreteChannels;
+    
+    for (const auto& speakers : { juce::AudioChannelSet::quadraphonic(),
+                                  juce::AudioChannelSet::create5point0(), juce::AudioChannelSet::create5point1(),
+                                  juce::AudioChannelSet::create7point0(), juce::AudioChannelSet::create7point1() })
+        if (layout == speakers)
+            return true;
+    
+    return false;
+}
+
+juce::AudioChannelSet SpatialPanner::getLayoutForName(const juce::String& name)
+{
+    const auto lower = name.trim().toLowerCase();
+    
+    if (lower == "mono")    return juce::AudioChannelSet::mono();
+    if (lower == "stereo")  return juce::AudioChannelSet::stereo();
+    if (lower == "quad")    return juce::AudioChannelSet::quadraphonic();
+    if (lower == "5.0")     return juce::AudioChannelSet::create5point0();
+    if (lower == "5.1")     return juce::AudioChannelSet::create5point1();
+    if (lower == "7.0")     return juce::AudioChannelSet::create7point0();
+    if (lower == "7.1")     return juce::AudioChannelSet::create7point1();
+    
+    if (lower.startsWith("ambi"))
+    {
+        const int order = lower.substring(4).getIntValue();
+        
+        if (order >= 1 && order <= mMaxAmbisonicOrder)
+            return juce::AudioChannelSet::ambisonic(order);
+    }
+    else if (lower.isNotEmpty() && lower.containsOnly("0123456789"))
+    {
+        const int numChannels = lower.getIntValue();
+        
+        if (numChannels >= 1 && numChannels <= mMaxDiscreteChannels)
+            return juce::AudioChannelSet::discreteChannels(numChannels);
+    }
+    
+    return juce::AudioChannelSet::disabled();
+}
+
+void SpatialPanner::prepare(const juce::AudioChannelSet& layout)
+{
+    jassert(isLayoutSupported(layout));
+    
+    mAmbisonicOrder = 0;
+    mRotations.clear();
+    
+    if (layout.size() <= 2)
+        buildStereo(juce::jmax(1, layout.size()));
+    else if (layout.getAmbisonicOrder() >= 1)
+        buildAmbisonic(layout.getAmbisonicOrder());
+    else
+        buildSpeakers(layout);
+    
+    buildPlacements(layout);
+}
+
+//==============================================================================
+void SpatialPanner::buildStereo(int numChannels)
+{
+    mNumChannels = numChannels;
+    mGains.assign(static_cast<size_t>((mTableSize + 1) * mNumChannels), 0.0f);
+    
+    for (int row = 0; row <= mTableSize; ++row)
+    {
+        auto* gains = mGains.data() + row * mNumChannels;
+        
+        // constant-power pan; a mono output hears every grain as a centred one
+        const double angle = static_cast<double>(row) / mTableSize * juce::MathConstants<double>::halfPi;
+        
+        if (mNumChannels == 1)
+        {
+            gains[0] = juce::MathConstants<float>::sqrt2 * 0.5f;
+        }
+        else
+        {
+            gains[0] = static_cast<float>(std::cos(angle));
+            gains[1] = static_cast<float>(std::sin(angle));
+        }
+    }
+}
+
+void SpatialPanner::buildSpeakers(const juce::AudioChannelSet& layout)
+{
+    mNumChannels = layout.size();
+    mGains.assign(static_cast<size_t>((mTableSize + 1) * mNumChannels), 0.0f);
+    
+    // placed speakers, sorted by azimuth in radians from -pi
+    std::vector<std::pair<double, int>> speakers;
+    const bool quadraphonic = layout == juce::AudioChannelSet::quadraphonic();
+    
+    for (int channel = 0; channel < mNumChannels; ++channel)
+    {
+        double azimuth = layout.isDiscreteLayout() ? 360.0 * channel / mNumChannels
+                                                   : getSpeakerAzimuth(layout.getTypeOfChannel(channel), quadraphonic);
+        
+        if (std::isnan(azimuth))
+            continue;
+        
+        if (azimuth >= 180.0)
+            azimuth -= 360.0;
+        
+        speakers.push_back({ juce::degreesToRadians(azimuth), channel });
+    }
+    
+    std::sort(speakers.begin(), speakers.end());
+    
+    const auto numSpeakers = static_cast<int>(speakers.size());
+    const double twoPi = juce::MathConstants<double>::twoPi;
+    
+    for (int row = 0; row <= mTableSize; ++row)
+    {
+        auto* gains = mGains.data() + row * mNumChannels;
+        const double azimuth = (2.0 * row / mTableSize - 1.0) * juce::MathConstants<double>::pi;
+        
+        if (numSpeakers == 1)
+        {
+            gains[speakers.front().second] = 1.0f;
+            continue;
+        }
+        
+        // the pair either side of the azimuth; the last and first speakers pair up behind
+        int upper = 0;
+        
+        while (upper < numSpeakers && speakers[static_cast<size_t>(upper)].first <= azimuth)
+            ++upper;
+        
+        const auto& [upperAzimuth, upperChannel] = speakers[static_cast<size_t>(upper % numSpeakers)];
+        const auto& [lowerAzimuth, lowerChannel] = speakers[static_cast<size_t>((upper + numSpeakers - 1) % numSpeakers)];
+        
+        const double span = std::fmod(upperAzimuth - lowerAzimuth + twoPi, twoPi);
+        const double offset = std::fmod(azimuth - lowerAzimuth + twoPi, twoPi);
+        const double angle = (span > 0.0 ? offset / span : 0.0) * juce::MathConstants<double>::halfPi;
+        
+        gains[lowerChannel] = static_cast<float>(std::cos(angle));
+        gains[upperChannel] = static_cast<float>(std::sin(angle));
+    }
+}
+
+void SpatialPanner::buildAmbisonic(int order)
+{
+    mNumChannels = (order + 1) * (order + 1);
+    mGains.assign(static_cast<size_t>((mTableSize + 1) * mNumChannels), 0.0f);
+    
+    for (int row = 0; row <= mTableSize; ++row)
+    {
+        auto* gains = mGains.data() + row * mNumChannels;
+        
+        // the pan turns clockwise, ambisonic azimuths anticlockwise
+        const double azimuth = -(2.0 * row / mTableSize - 1.0) * juce::MathConstants<double>::pi;
+        
+        for (int acn = 0; acn < mNumChannels; ++acn)
+            gains[acn] = static_cast<float>(getHorizontalHarmonic(acn, azimuth));
+    }
+    
+    mAmbisonicOrder = order;
+    mRotations.assign(static_cast<size_t>((mTableSize + 1) * 2 * order), 0.0f);
+    
+    for (int row = 0; row <= mTableSize; ++row)
+    {
+        auto* rotation = mRotations.data() + row * 2 * order;
+        const double azimuth = -(2.0 * row / mTableSize - 1.0) * juce::MathConstants<double>::pi;
+        
+        for (int m = 1; m <= order; ++m)
+        {
+            rotation[2 * (m - 1)] = static_cast<float>(std::cos(m * azimuth));
+            rotation[2 * (m - 1) + 1] = static_cast<float>(std::sin(m * azimuth));
+        }
+    }
+}
+
+void SpatialPanner::buildPlacements(const juce::AudioChannelSet& layout)
+{
+    mPlacements.clear();
+    mPlacements.reserve(static_cast<size_t>(mNumChannels * (mNumChannels + 1) / 2));
+    
+    const bool speakers = mAmbisonicOrder == 0 && ! layout.isDiscreteLayout();
+    const bool quadraphonic = layout == juce::AudioChannelSet::quadraphonic();
+    
+    for (int numSourceChannels = 1; numSourceChannels <= mNumChannels; ++numSourceChannels)
+    {
+        for (int channel = 0; channel < numSourceChannels; ++channel)
+        {
+            SourcePlacement placement;
+            
+            if (numSourceChannels == 2)
+            {
+                placement.panOffset = channel == 0 ? -mStereoOffset : mStereoOffset;
+            }
+            else if (numSourceChannels == mNumChannels && speakers)
+            {
+                const double azimuth = getSpeakerAzimuth(layout.getTypeOfChannel(channel), quadraphonic);
+                placement.direct = std::isnan(azimuth);
+                placement.panOffset = placement.direct ? 0.0f : static_cast<float>(azimuth / 180.0);
+            }
+            else
+            {
+                // a mono source is the ring's one channel, at the pan itself
+                const float offset = 2.0f * static_cast<float>(channel) / static_cast<float>(numSourceChannels);
+                placement.panOffset = offset > 1.0f ? offset - 2.0f : offset;
+            }
+            
+            mPlacements.push_back(placement);
+        }
+    }
+}
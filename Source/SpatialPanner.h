@@ -0,0 +1,122 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+// Per-grain gains for every channel of the output layout, looked up from a table
+// built once per layout, so placing a grain costs one row pointer.
+//
+// Grains are placed by their pan, -1 to 1:
+// - stereo (and mono) keep the constant-power left/right law
+// - speaker layouts (quad, 5.0/5.1, 7.0/7.1, discrete rings) map the pan to an azimuth
+//   all the way round, 0 at the front and +-1 behind, and pan constant-power between
+//   the two speakers either side of it; LFE channels get nothing
+// - ambisonic layouts (orders 1 to 3, ACN order, SN3D) get the horizontal encoding of
+//   the same azimuth
+//
+// Discrete layouts are a ring of speakers: channel 1 at the front and the rest evenly
+// spaced clockwise.
+//
+// Beyond stereo every source channel of a grain is placed on its own, relative to the
+// grain's pan, so the source keeps its image instead of collapsing to a point:
+// - mono is a point source at the pan
+// - stereo is a pair 30 degrees either side of it
+// - a source with as many channels as a speaker layout keeps each channel at its
+//   speaker's azimuth, turned by the pan; the LFE goes straight to the LFE
+// - a source with as many channels as an ambisonic layout is taken to be that sound
+//   field, and rotated by the pan
+// - anything else is a ring evenly spaced clockwise from the pan
+class SpatialPanner
+{
+public:
+    // starts out stereo
+    SpatialPanner();
+    
+    static bool isLayoutSupported(const juce::AudioChannelSet& layout);
+    
+    // for the command-line tools: "mono", "stereo", "quad", "5.0", "5.1", "7.0", "7.1",
+    // "ambi1" to "ambi3", or a number of speakers in a discrete ring; disabled() for
+    // anything else
+    static juce::AudioChannelSet getLayoutForName(const juce::String& name);
+    
+    // not while rendering; builds the table for the layout
+    void prepare(const juce::AudioChannelSet& layout);
+    
+    int getNumChannels() const noexcept { return mNumChannels; }
+    
+    // more than two channels: each source channel of a grain is placed on its own
+    bool isSpatial() const noexcept { return mNumChannels > 2; }
+    
+    // getNumChannels() gains for a grain at pan
+    const float* getGains(float pan) const noexcept { return mGains.data() + static_cast<size_t>(getRow(pan) * mNumChannels); }
+    
+    // the same at pan + offset, taken round the circle
+    const float* getGains(float pan, float offset) const noexcept
+    {
+        float placed = pan + offset;
+        
+        if (placed > 1.0f)
+            placed -= 2.0f;
+        else if (placed < -1.0f)
+            placed += 2.0f;
+        
+        return getGains(placed);
+    }
+    
+    // where source channel of a grain with numSourceChannels (<= getNumChannels()) goes
+    struct SourcePlacement
+    {
+        float panOffset { 0.0f };   // from the grain's pan
+        bool direct { false };      // straight to the output channel of the same index (an LFE)
+    };
+    
+    // numSourceChannels placements, one per source channel
+    const SourcePlacement* getSourcePlacements(int numSourceChannels) const noexcept
+    {
+        jassert(numSourceChannels >= 1 && numSourceChannels <= mNumChannels);
+        return mPlacements.data() + static_cast<size_t>((numSourceChannels - 1) * numSourceChannels / 2);
+    }
+    
+    // 0 unless the layout is ambisonic
+    int getAmbisonicOrder() const noexcept { return mAmbisonicOrder; }
+    
+    // an ambisonic source of the output's own order is rotated rather than placed
+    bool rotatesSource(int numSourceChannels) const noexcept { return mAmbisonicOrder > 0 && numSourceChannels == mNumChannels; }
+    
+    // cos(m * azimuth) and sin(m * azimuth) for m = 1 to getAmbisonicOrder(), turning a
+    // sound field anticlockwise to where the pan points
+    const float* getRotation(float pan) const noexcept { return mRotations.data() + static_cast<size_t>(getRow(pan) * 2 * mAmbisonicOrder); }
+    
+    // a discrete ring can have this many speakers at most
+    static constexpr int mMaxDiscreteChannels { 64 };
+
+private:
+    //==============================================================================
+    void buildStereo(int numChannels);
+    void buildSpeakers(const juce::AudioChannelSet& layout);
+    void buildAmbisonic(int order);
+    void buildPlacements(const juce::AudioChannelSet& layout);
+    
+    int getRow(float pan) const noexcept { return juce::jlimit(0, mTableSize, juce::roundToInt((pan + 1.0f) * 0.5f * static_cast<float>(mTableSize))); }
+    
+    // steps across the pan range; a third of a degree round the circle
+    static constexpr int mTableSize { 1024 };
+    
+    static constexpr int mMaxAmbisonicOrder { 3 };
+    
+    // either side of a stereo source's pan, as a fraction of half the circle
+    static constexpr float mStereoOffset { 1.0f / 6.0f };
+    
+    // (mTableSize + 1) rows of mNumChannels gains
+    std::vector<float> mGains;
+    int mNumChannels { 0 };
+    int mAmbisonicOrder { 0 };
+    
+    // (mTableSize + 1) rows of 2 * mAmbisonicOrder rotation terms
+    std::vector<float> mRotations;
+    
+    // the placements for 1, 2, ... mNumChannels source channels, one after the other
+    std::vector<SourcePlacement> mPlacements;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SpatialPanner)
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+// Hands the latest value of T from one writer thread to one reader thread without
+// locks or waiting on either side. The writer fills getWriteBuffer() and publishes
+// it; the reader always gets the newest complete value. The third buffer is what
+// lets both sides swap without ever touching the buffer the other one is using.
+template <typename T>
+class TripleBuffer
+{
+public:
+    //==============================================================================
+    // writer
+    T& getWriteBuffer() noexcept { return mBuffers[static_cast<size_t>(mWriteIndex)]; }
+    
+    void publish() noexcept
+    {
+        const int previous = mMiddle.exchange(mWriteIndex | freshBit, std::memory_order_acq_rel);
+        mWriteIndex = previous & indexMask;
+    }
+    
+    // true while the last published value hasn't been read yet, so a writer that only
+    // needs to keep up with the reader can skip filling a new one
+    bool isPublishPending() const noexcept { return (mMiddle.load(std::memory_order_acquire) & freshBit) != 0; }
+    
+    //==============================================================================
+    // reader
+    const T& read() noexcept
+    {
+        if (mMiddle.load(std::memory_order_acquire) & freshBit)
+            mReadIndex = mMiddle.exchange(mReadIndex, std::memory_order_acq_rel) & indexMask;
+        
+        return mBuffers[static_cast<size_t>(mReadIndex)];
+    }
+    
+    //==============================================================================
+    // only while neither side is running, e.g. to size the buffers in prepareToPlay
+    template <typename Function>
+    void forEachBuffer(Function&& function)
+    {
+        for (auto& buffer : mBuffers)
+            function(buffer);
+    }
+
+private:
+    static constexpr int indexMask { 3 };
+    static constexpr int freshBit { 4 };
+    
+    std::array<T, 3> mBuffers;
+    int mWriteIndex { 0 };
+    int mReadIndex { 1 };
+    std::atomic<int> mMiddle { 2 };
+};
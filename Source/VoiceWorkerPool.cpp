@@ -0,0 +1,167 @@
+#include "VoiceWorkerPool.h"
+#include "RealtimeSafety.h"
+
+//==============================================================================
+class VoiceWorkerPool::Worker : public juce::Thread
+{
+public:
+    Worker(VoiceWorkerPool& ownerPool, int index)
+        : juce::Thread("Voice worker " + juce::String(index)), pool(ownerPool)
+    {
+    }
+    
+    ~Worker() override
+    {
+        signalThreadShouldExit();
+        notify();
+        stopThread(1000);
+    }
+    
+    void wake() noexcept
+    {
+        if (parked.load(std::memory_order_acquire))
+            notify();
+    }
+    
+    void run() override
+    {
+        // same floating-point environment as the audio thread, or results would differ
+        juce::ScopedNoDenormals noDenormals;
+        RealtimeSafety::ScopedRealtimeSection realtimeSection;
+        
+        auto lastBatch = pool.getCurrentBatch();
+        int idleSpins = 0;
+        
+        while (! threadShouldExit())
+        {
+            const auto batch = pool.getCurrentBatch();
+            
+            if (batch != lastBatch)
+            {
+                lastBatch = batch;
+                idleSpins = 0;
+                pool.processTasks(batch);
+                continue;
+            }
+            
+            // batches arrive once per block, so spin briefly before paying for a wake-up
+            if (++idleSpins < maxIdleSpins)
+            {
+                juce::Thread::yield();
+                continue;
+            }
+            
+            // idle (transport stopped or serial rendering): park until the next batch;
+            // the timeout covers a notify() racing with the flag
+            parked.store(true, std::memory_order_release);
+            
+            if (pool.getCurrentBatch() == lastBatch)
+                wait(parkTimeoutMs);
+            
+            parked.store(false, std::memory_order_release);
+            idleSpins = 0;
+        }
+    }
+
+private:
+    static constexpr int maxIdleSpins { 20000 };
+    static constexpr int parkTimeoutMs { 10 };
+    
+    VoiceWorkerPool& pool;
+    std::atomic<bool> parked { false };
+};
+
+//==============================================================================
+VoiceWorkerPool::VoiceWorkerPool() {}
+
+VoiceWorkerPool::~VoiceWorkerPool()
+{
+    setNumWorkers(0);
+}
+
+void VoiceWorkerPool::setNumWorkers(int numWorkersToUse, double sampleRate, int samplesPerBlock)
+{
+    numWorkersToUse = juce::jlimit(0, mMaxWorkers, numWorkersToUse);
+    
+    if (numWorkersToUse == getNumWorkers() && (numWorkersToUse == 0 || (sampleRate == mSampleRate && samplesPerBlock == mSamplesPerBlock)))
+        return;
+    
+    mWorkers.clear();
+    mSampleRate = sampleRate;
+    mSamplesPerBlock = samplesPerBlock;
+    
+    if (numWorkersToUse == 0)
+        return;
+    
+    // the period lets the OS reserve each worker its share of every block
+    jassert(sampleRate > 0.0 && samplesPerBlock > 0);
+    const auto options = juce::Thread::RealtimeOptions {}.withApproximateAudioProcessingTime(samplesPerBlock, sampleRate);
+    
+    for (int i = 0; i < numWorkersToUse; ++i)
+    {
+        mWorkers.push_back(std::make_unique<Worker>(*this, i));
+        
+        // without realtime rights (e.g. a sandboxed Linux host) the highest normal
+        // priority is the best left
+        if (! mWorkers.back()->startRealtimeThread(options))
+            mWorkers.back()->startThread(juce::Thread::Priority::highest);
+    }
+}
+
+void VoiceWorkerPool::run(int numTasks, TaskFunction task, void* context) noexcept
+{
+    if (numTasks <= 0)
+        return;
+    
+    if (mWorkers.empty() || numTasks == 1)
+    {
+        for (int i = 0; i < numTasks; ++i)
+            task(context, i);
+        
+        return;
+    }
+    
+    // workers only read the batch description after seeing the new claim word
+    mTask = task;
+    mContext = context;
+    mNumTasks.store(numTasks, std::memory_order_relaxed);
+    mNumCompleted.store(0, std::memory_order_relaxed);
+    
+    ++mBatch;
+    mClaim.store(static_cast<juce::uint64>(mBatch) << 32, std::memory_order_release);
+    
+    for (auto& worker : mWorkers)
+        worker->wake();
+    
+    processTasks(mBatch);
+    
+    // the remaining tasks are already running on workers, so this wait is short
+    while (mNumCompleted.load(std::memory_order_acquire) < numTasks)
+        juce::Thread::yield();
+}
+
+void VoiceWorkerPool::processTasks(juce::uint32 batch) noexcept
+{
+    auto claim = mClaim.load(std::memory_order_acquire);
+    
+    for (;;)
+    {
+        if (static_cast<juce::uint32>(claim >> 32) != batch)
+            return;
+        
+        const int taskIndex = static_cast<int>(claim & 0xffffffffu);
+        
+        // a stale claim word may be compared against the next batch's count here;
+        // the CAS below then fails on the batch number, so that is harmless
+        if (taskIndex >= mNumTasks.load(std::memory_order_relaxed))
+            return;
+        
+        if (! mClaim.compare_exchange_weak(claim, claim + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            continue;
+        
+        mTask(mContext, taskIndex);
+        mNumCompleted.fetch_add(1, std::memory_order_release);
+        
+        claim = mClaim.load(std::memory_order_acquire);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+// A fixed set of worker threads that help the audio thread get through a batch of
+// independent tasks (one per active voice).
+//
+// run() publishes the batch, then the calling thread claims tasks alongside the
+// workers until the batch is done. Tasks are claimed from a single lock-free counter,
+// so whichever thread is free takes the next task and a slow voice never holds up the
+// others. Nothing here allocates or locks on the audio thread: the batch is described
+// by a plain function pointer and context, and parked workers are woken with
+// Thread::notify() only after they have gone idle.
+//
+// One shared counter balances the load without per-worker queues: even at the full
+// 512 voices a block is a few hundred claims of one compare-and-swap each, which is
+// noise next to rendering a single voice. Workers run as realtime threads told the
+// block period, like the audio thread they help; at a normal priority any busy
+// thread could preempt one for longer than a block.
+class VoiceWorkerPool
+{
+public:
+    using TaskFunction = void (*)(void* context, int taskIndex);
+    
+    VoiceWorkerPool();
+    ~VoiceWorkerPool();
+    
+    // message thread only; (re)starts the workers for blocks of samplesPerBlock at
+    // sampleRate, 0 stops them
+    void setNumWorkers(int numWorkersToUse, double sampleRate = 0.0, int samplesPerBlock = 0);
+    int getNumWorkers() const noexcept { return static_cast<int>(mWorkers.size()); }
+    
+    // runs task(context, i) for every i in [0, numTasks) and returns once all of them
+    // have finished; with no workers everything runs on the calling thread
+    void run(int numTasks, TaskFunction task, void* context) noexcept;
+    
+    static constexpr int mMaxWorkers { 8 };
+
+private:
+    class Worker;
+    
+    // claims and runs tasks of the given batch until none are left
+    void processTasks(juce::uint32 batch) noexcept;
+    
+    juce::uint32 getCurrentBatch() const noexcept { return static_cast<juce::uint32>(mClaim.load(std::memory_order_acquire) >> 32); }
+    
+    // batch number in the high word, next unclaimed task in the low one, so a worker
+    // still finishing an old batch can never claim a task from the next
+    std::atomic<juce::uint64> mClaim { 0 };
+    std::atomic<int> mNumCompleted { 0 };
+    
+    TaskFunction mTask { nullptr };
+    void* mContext { nullptr };
+    std::atomic<int> mNumTasks { 0 };
+    juce::uint32 mBatch { 0 };
+    
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    double mSampleRate { 0.0 };
+    int mSamplesPerBlock { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VoiceWorkerPool)
+};
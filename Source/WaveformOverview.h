@@ -0,0 +1,312 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+// A min/max/RMS pyramid over the live buffer, for drawing it without scanning it.
+//
+// Level 0 summarises every mMinSamplesPerBucket samples, or a power-of-two multiple of
+// that for buffers long enough to need more than mMaxBuckets; each further level
+// summarises mLevelRatio buckets of the one below. append() folds each write into a
+// running summary of the bucket the write head is in and only recombines the levels
+// above the buckets it changed, so keeping it current costs about as much as the
+// write itself however long the buckets are, and a view of any width can pick a level
+// with between one and mLevelRatio buckets per pixel. Capping the bucket count keeps the copies handed to the GUI
+// small however long the buffer is.
+class WaveformOverview
+{
+public:
+    static constexpr int mMinSamplesPerBucket { 64 };
+    static constexpr int mMaxBuckets { 8192 };
+    static constexpr int mLevelRatio { 4 };
+    static constexpr int mNumLevels { 4 };
+    
+    struct Bucket
+    {
+        float min { 0.0f };
+        float max { 0.0f };
+        float meanSquare { 0.0f };
+    };
+    
+    struct Level
+    {
+        int samplesPerBucket { 0 };
+        int numBuckets { 0 };
+        std::vector<Bucket> buckets;    // numBuckets per channel, channel after channel
+        
+        const Bucket* getChannel(int channel) const noexcept { return buckets.data() + channel * numBuckets; }
+    };
+    
+    //==============================================================================
+    // allocates; message thread
+    void prepare(int numChannelsToUse, int bufferSizeToUse)
+    {
+        mNumChannels = numChannelsToUse;
+        mBufferSize = bufferSizeToUse;
+        mWritePosition = 0;
+        mRunning.assign(static_cast<size_t>(mNumChannels), Running {});
+        
+        mSamplesPerBucket = mMinSamplesPerBucket;
+        
+        while (mBufferSize / mSamplesPerBucket > mMaxBuckets)
+            mSamplesPerBucket *= 2;
+        
+        int samplesPerBucket = mSamplesPerBucket;
+        
+        for (auto& level : mLevels)
+        {
+            level.samplesPerBucket = samplesPerBucket;
+            level.numBuckets = (mBufferSize + samplesPerBucket - 1) / samplesPerBucket;
+            level.buckets.assign(static_cast<size_t>(mNumChannels * level.numBuckets), Bucket {});
+            
+            samplesPerBucket *= mLevelRatio;
+        }
+    }
+    
+    // back to silence, without reallocating
+    void clear() noexcept
+    {
+        for (auto& level : mLevels)
+            std::fill(level.buckets.begin(), level.buckets.end(), Bucket {});
+        
+        std::fill(mRunning.begin(), mRunning.end(), Running {});
+        mWritePosition = 0;
+    }
+    
+    // For the write head: folds [start, start + numSamples) of one channel, written
+    // straight after the last append(), into the summary of the bucket the head is in;
+    // entering a bucket starts its summary afresh. data points at the first buffer
+    // sample. The range must not wrap.
+    template <typename SampleType>
+    void append(int channel, const SampleType* data, int start, int numSamples) noexcept
+    {
+        if (numSamples <= 0 || channel >= mNumChannels)
+            return;
+        
+        jassert(start >= 0 && start + numSamples <= mBufferSize);
+        
+        auto& base = mLevels[0];
+        auto& running = mRunning[static_cast<size_t>(channel)];
+        const int end = start + numSamples;
+        
+        for (int position = start; position < end;)
+        {
+            const int bucket = position / mSamplesPerBucket;
+            const int bucketStart = bucket * mSamplesPerBucket;
+            const int pieceEnd = juce::jmin(end, bucketStart + mSamplesPerBucket);
+            
+            // a head that jumped into the middle of a bucket (after a clear or a resize)
+            // is the one time the bucket's start is read back
+            if (running.bucket != bucket || running.end != position)
+                seed(running, bucket, data + bucketStart, position - bucketStart);
+            
+            fold(running, data + position, pieceEnd - position);
+            running.end = pieceEnd;
+            
+            base.buckets[static_cast<size_t>(channel * base.numBuckets + bucket)] = running.getBucket();
+            position = pieceEnd;
+        }
+        
+        updateLevelsAbove(channel, start / mSamplesPerBucket, (end - 1) / mSamplesPerBucket);
+    }
+    
+    // Recomputes the buckets covering [start, start + numSamples) of one channel from
+    // data, which points at the first buffer sample, by rescanning them whole. For
+    // bulk copies (history moved by a resize), whose runs are long next to a bucket.
+    // The range must not wrap.
+    template <typename SampleType>
+    void update(int channel, const SampleType* data, int start, int numSamples) noexcept
+    {
+        if (numSamples <= 0 || channel >= mNumChannels)
+            return;
+        
+        jassert(start >= 0 && start + numSamples <= mBufferSize);
+        
+        const int first = start / mSamplesPerBucket;
+        const int last = (start + numSamples - 1) / mSamplesPerBucket;
+        
+        auto& base = mLevels[0];
+        auto& running = mRunning[static_cast<size_t>(channel)];
+        
+        for (int bucket = first; bucket <= last; ++bucket)
+        {
+            const int bucketStart = bucket * mSamplesPerBucket;
+            const int bucketLength = juce::jmin(mSamplesPerBucket, mBufferSize - bucketStart);
+            auto& summary = base.buckets[static_cast<size_t>(channel * base.numBuckets + bucket)];
+            
+            // the write head's bucket only ever summarises what the head has written
+            if (bucket == running.bucket)
+            {
+                seed(running, bucket, data + bucketStart, running.end - bucketStart);
+                summary = running.getBucket();
+            }
+            else
+            {
+                summary = summarise(data + bucketStart, bucketLength);
+            }
+        }
+        
+        updateLevelsAbove(channel, first, last);
+    }
+    
+    void setWritePosition(int newWritePosition) noexcept { mWritePosition = newWritePosition; }
+    
+    // no allocation as long as both were prepared with the same sizes
+    void copyFrom(const WaveformOverview& other) noexcept
+    {
+        jassert(other.mNumChannels == mNumChannels && other.mBufferSize == mBufferSize);
+        
+        for (size_t levelIndex = 0; levelIndex < mLevels.size(); ++levelIndex)
+            std::copy(other.mLevels[levelIndex].buckets.begin(), other.mLevels[levelIndex].buckets.end(), mLevels[levelIndex].buckets.begin());
+        
+        mWritePosition = other.mWritePosition;
+    }
+    
+    //==============================================================================
+    // the coarsest level that still has at least numColumns buckets (or the finest one)
+    const Level& getLevelFor(int numColumns) const noexcept
+    {
+        for (auto level = mLevels.rbegin(); level != mLevels.rend(); ++level)
+            if (level->numBuckets >= numColumns)
+                return *level;
+        
+        return mLevels.front();
+    }
+    
+    // Summarises buckets [firstBucket, firstBucket + numBuckets) of every channel;
+    // indices wrap around the buffer.
+    Bucket getRange(const Level& level, int firstBucket, int numBuckets) const noexcept
+    {
+        Bucket result { std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), 0.0f };
+        int count = 0;
+        
+        for (int channel = 0; channel < mNumChannels; ++channel)
+        {
+            const auto* buckets = level.getChannel(channel);
+            
+            for (int i = 0; i < numBuckets; ++i)
+            {
+                const auto& bucket = buckets[(firstBucket + i) % level.numBuckets];
+                
+                result.min = juce::jmin(result.min, bucket.min);
+                result.max = juce::jmax(result.max, bucket.max);
+                result.meanSquare += bucket.meanSquare;
+                ++count;
+            }
+        }
+        
+        if (count == 0)
+            return {};
+        
+        result.meanSquare /= static_cast<float>(count);
+        return result;
+    }
+    
+    int getNumChannels() const noexcept { return mNumChannels; }
+    int getBufferSize() const noexcept { return mBufferSize; }
+    int getWritePosition() const noexcept { return mWritePosition; }
+
+private:
+    //==============================================================================
+    // the bucket the write head is in, summarised up to the head
+    struct Running
+    {
+        int bucket { -1 };
+        int end { 0 };      // buffer index just past the last sample folded in
+        float min { 0.0f };
+        float max { 0.0f };
+        float sumOfSquares { 0.0f };
+        int count { 0 };
+        
+        Bucket getBucket() const noexcept { return { min, max, count > 0 ? sumOfSquares / static_cast<float>(count) : 0.0f }; }
+    };
+    
+    template <typename SampleType>
+    static void fold(Running& running, const SampleType* data, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const auto sample = static_cast<float>(data[i]);
+            
+            running.min = running.count > 0 ? juce::jmin(running.min, sample) : sample;
+            running.max = running.count > 0 ? juce::jmax(running.max, sample) : sample;
+            running.sumOfSquares += sample * sample;
+            ++running.count;
+        }
+    }
+    
+    // starts the summary of bucket over from the numWritten samples at its start
+    template <typename SampleType>
+    void seed(Running& running, int bucket, const SampleType* bucketData, int numWritten) const noexcept
+    {
+        running = Running {};
+        running.bucket = bucket;
+        running.end = bucket * mSamplesPerBucket + numWritten;
+        fold(running, bucketData, numWritten);
+    }
+    
+    // recombines whatever sits above level 0 buckets [first, last]
+    void updateLevelsAbove(int channel, int first, int last) noexcept
+    {
+        for (size_t levelIndex = 1; levelIndex < mLevels.size(); ++levelIndex)
+        {
+            const auto& below = mLevels[levelIndex - 1];
+            auto& level = mLevels[levelIndex];
+            
+            first /= mLevelRatio;
+            last /= mLevelRatio;
+            
+            for (int bucket = first; bucket <= last; ++bucket)
+            {
+                const int firstChild = bucket * mLevelRatio;
+                const int numChildren = juce::jmin(mLevelRatio, below.numBuckets - firstChild);
+                
+                level.buckets[static_cast<size_t>(channel * level.numBuckets + bucket)] = combine(below.getChannel(channel) + firstChild, numChildren);
+            }
+        }
+    }
+    
+    template <typename SampleType>
+    static Bucket summarise(const SampleType* data, int numSamples) noexcept
+    {
+        Bucket bucket { static_cast<float>(data[0]), static_cast<float>(data[0]), 0.0f };
+        float sumOfSquares = 0.0f;
+        
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const auto sample = static_cast<float>(data[i]);
+            
+            bucket.min = juce::jmin(bucket.min, sample);
+            bucket.max = juce::jmax(bucket.max, sample);
+            sumOfSquares += sample * sample;
+        }
+        
+        bucket.meanSquare = sumOfSquares / static_cast<float>(numSamples);
+        return bucket;
+    }
+    
+    static Bucket combine(const Bucket* children, int numChildren) noexcept
+    {
+        Bucket bucket = children[0];
+        
+        for (int i = 1; i < numChildren; ++i)
+        {
+            bucket.min = juce::jmin(bucket.min, children[i].min);
+            bucket.max = juce::jmax(bucket.max, children[i].max);
+            bucket.meanSquare += children[i].meanSquare;
+        }
+        
+        bucket.meanSquare /= static_cast<float>(numChildren);
+        return bucket;
+    }
+    
+    //==============================================================================
+    std::array<Level, mNumLevels> mLevels;
+    int mNumChannels { 0 };
+    int mBufferSize { 0 };
+    int mSamplesPerBucket { mMinSamplesPerBucket };
+    int mWritePosition { 0 };
+    
+    // one per channel; append() and update() only, so copies don't carry it
+    std::vector<Running> mRunning;
+};
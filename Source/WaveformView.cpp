@@ -0,0 +1,76 @@
+#include "WaveformView.h"
+
+//==============================================================================
+WaveformView::WaveformView (LiveGranularSynthAudioProcessor& p)
+    : audioProcessor (p)
+{
+    setOpaque (true);
+    startTimerHz (60);
+}
+
+WaveformView::~WaveformView()
+{
+}
+
+//==============================================================================
+void WaveformView::paint (juce::Graphics& g)
+{
+    g.fillAll (juce::Colours::black);
+
+    audioProcessor.readWaveformOverview (latestOverview);
+
+    const auto& overview = latestOverview;
+    const int width = getWidth();
+
+    if (overview.getBufferSize() == 0 || width <= 0)
+        return;
+
+    // between one and WaveformOverview::mLevelRatio buckets per pixel, whatever the width
+    const auto& level = overview.getLevelFor (width);
+    const int headBucket = overview.getWritePosition() / level.samplesPerBucket;
+    const float centre = 0.5f * static_cast<float> (getHeight());
+
+    for (int x = 0; x < width; ++x)
+    {
+        const int first = x * level.numBuckets / width;
+        const int next = (x + 1) * level.numBuckets / width;
+        const auto bucket = overview.getRange (level, headBucket + first, juce::jmax (1, next - first));
+        const float rms = std::sqrt (bucket.meanSquare);
+
+        g.setColour (juce::Colours::darkgrey);
+        g.drawVerticalLine (x, centre - juce::jlimit (-1.0f, 1.0f, bucket.max) * centre, centre - juce::jlimit (-1.0f, 1.0f, bucket.min) * centre);
+
+        g.setColour (juce::Colours::lightgrey);
+        g.drawVerticalLine (x, centre - juce::jmin (1.0f, rms) * centre, centre + juce::jmin (1.0f, rms) * centre);
+    }
+
+    paintGrains (g, overview);
+}
+
+void WaveformView::paintGrains (juce::Graphics& g, const WaveformOverview& overview)
+{
+    const auto& snapshot = audioProcessor.readGrainSnapshot();
+    const float head = static_cast<float> (overview.getWritePosition()) / static_cast<float> (overview.getBufferSize());
+    const float width = static_cast<float> (getWidth());
+    const float height = static_cast<float> (getHeight());
+
+    for (int i = 0; i < snapshot.numGrains; ++i)
+    {
+        const auto& dot = snapshot.grains[static_cast<size_t> (i)];
+
+        // how far behind the write head the grain reads, as a fraction of the buffer
+        float age = dot.position - head;
+        age -= std::floor (age);
+
+        const float size = 3.0f + 5.0f * dot.level;
+
+        g.setColour (juce::Colours::orange.withAlpha (0.3f + 0.7f * dot.level));
+        g.fillEllipse (age * width - 0.5f * size, 0.5f * (height - size), size, size);
+    }
+}
+
+//==============================================================================
+void WaveformView::timerCallback()
+{
+    repaint();
+}
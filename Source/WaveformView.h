@@ -0,0 +1,29 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+//==============================================================================
+// The live buffer, oldest material on the left and the write head on the right, with
+// a dot for every active grain. Drawn from the processor's published overview and
+// grain snapshot, so a repaint costs O(width) and never waits for the audio thread.
+class WaveformView  : public juce::Component,
+                     private juce::Timer
+{
+public:
+    explicit WaveformView (LiveGranularSynthAudioProcessor&);
+    ~WaveformView() override;
+
+    void paint (juce::Graphics&) override;
+
+private:
+    void timerCallback() override;
+    void paintGrains (juce::Graphics&, const WaveformOverview&);
+
+    LiveGranularSynthAudioProcessor& audioProcessor;
+
+    // the processor's newest overview, copied in on every repaint
+    WaveformOverview latestOverview;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WaveformView)
+};
@@ -0,0 +1,911 @@
+/*
+  ==============================================================================
+
+    Headless processBlock benchmark and output/performance regression check.
+
+    Drives LiveGranularSynthAudioProcessor with synthetic input and scripted MIDI
+    across block sizes, sample rates, held-note counts and grain densities, and
+    reports ns/sample, the share of the real-time budget used and the worst block.
+
+    --full              sweep the whole grid instead of one axis at a time
+    --seconds <n>       seconds of audio rendered per scenario (default 4)
+    --parallel          render voices on the worker pool
+    --interpolation <n> 0 auto, 1 linear, 2 hermite, 3 lagrange, 4 sinc (default 0)
+    --polyphony <n>     voices allocated by prepareToPlay (default 16); use with
+                        --notes to hold big chords
+    --notes <n>         held notes in every scenario, instead of the notes axis
+    --storage <n>       live buffer format: 0 float, 1 16-bit integer, 2 half float
+                        (default 0)
+    --compare-storage   run every scenario once per buffer format
+    --power-of-two      round the live buffer up to a power of two
+    --double            process in double precision, as hosts that mix in double do
+    --compare-precision run every scenario once in float and once in double
+    --overlap-add       render grains with the Overlap-Add engine
+    --compare-synthesis run every scenario once per synthesis mode
+    --crossover         for each grain size, find the lowest density at which
+                        Overlap-Add beats the time domain
+    --layout <name>     output layout: mono, stereo, quad, 5.0, 5.1, 7.0, 7.1,
+                        ambi1 to ambi3, or a number of speakers in a ring
+                        (default stereo)
+    --governor          leave the CPU governor on; off by default so every run
+                        renders the same cloud whatever the machine's load
+    --realtime-check    stress note-ons/offs and block-size changes and fail if
+                        anything allocates inside processBlock or on a worker, in
+                        both precisions, with Overlap-Add and into third-order
+                        ambisonics
+
+    Regression mode renders a fixed set of short, seeded cases (each interpolation
+    and window mode, buffer wrap-around, the compact formats, voice stealing, random
+    jitter, double precision, Overlap-Add, surround and ambisonic outputs) instead
+    of the benchmark scenarios. It also renders two cases in both synthesis modes,
+    one that Overlap-Add takes and one with spray and pitch spray that it leaves to
+    the time domain; both must match the time domain to within 1e-5 of its peak.
+    Both modes fail the run:
+
+    --regression-record <dir>   store each case's output (32-bit float WAV) in dir
+                                as the reference
+    --regression-check <dir>    render again and fail if any reference is missing,
+                                if any output differs from it by more than
+                                --tolerance, or if repeated runs disagree
+    --tolerance <x>             largest sample difference allowed (default 1e-4)
+    --baseline <file>           also time the cases: record writes each one's
+                                ns/sample to file, and check fails any case more
+                                than --max-slowdown percent slower than it. Timings
+                                only hold on the machine that recorded them, so
+                                keep the file out of the repository
+    --max-slowdown <percent>    default 10
+    --runs <n>                  renders per case; the fastest is timed (default 3)
+
+    The references CTest checks against are in Tools/Benchmark/Regression; build the
+    record-regression target to rewrite them after an intended change to the sound.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "RealtimeSafety.h"
+
+namespace
+{
+    //==============================================================================
+    struct Scenario
+    {
+        int blockSize { 512 };
+        double sampleRate { 48000.0 };
+        int numNotes { 4 };
+        float density { 50.0f };
+        float grainSizeMs { 100.0f };
+    };
+
+    struct Timing
+    {
+        juce::int64 totalTicks { 0 };
+        juce::int64 worstTicks { 0 };
+    };
+
+    struct Result
+    {
+        double nsPerSample { 0.0 };
+        double realtimePercent { 0.0 };
+        double worstBlockMs { 0.0 };
+        double budgetMs { 0.0 };
+        juce::int64 allocations { 0 };
+    };
+
+    constexpr std::array<int, 8> blockSizes { 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+    constexpr std::array<double, 4> sampleRates { 44100.0, 48000.0, 96000.0, 192000.0 };
+    constexpr std::array<int, 4> noteCounts { 1, 4, 8, 16 };
+    constexpr std::array<float, 4> densities { 10.0f, 50.0f, 200.0f, 1000.0f };
+
+    // the --crossover grid
+    constexpr std::array<float, 5> crossoverGrainSizes { 10.0f, 25.0f, 50.0f, 100.0f, 250.0f };
+    constexpr std::array<float, 7> crossoverDensities { 25.0f, 50.0f, 100.0f, 200.0f, 500.0f, 1000.0f, 2000.0f };
+
+    //==============================================================================
+    // two detuned sines plus a little noise, so grains always have signal to read
+    template <typename SampleType>
+    void fillInput(juce::AudioBuffer<SampleType>& buffer, int numSamples, double sampleRate, juce::int64 startSample, juce::Random& random)
+    {
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            auto* data = buffer.getWritePointer(channel);
+            const double frequency = 220.0 * (1.0 + 0.01 * channel);
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                const double phase = juce::MathConstants<double>::twoPi * frequency * static_cast<double>(startSample + i) / sampleRate;
+                data[i] = static_cast<SampleType>(0.5f * static_cast<float>(std::sin(phase)) + 0.05f * (random.nextFloat() * 2.0f - 1.0f));
+            }
+        }
+    }
+
+    // 26 notes a minor third apart per MIDI channel, so big chords spill onto more channels
+    constexpr int notesPerChannel { 26 };
+    constexpr int maxNotes { notesPerChannel * 16 };
+
+    juce::MidiMessage noteOn(int index)   { return juce::MidiMessage::noteOn(1 + index / notesPerChannel, 48 + 3 * (index % notesPerChannel), 0.8f); }
+    juce::MidiMessage noteOff(int index)  { return juce::MidiMessage::noteOff(1 + index / notesPerChannel, 48 + 3 * (index % notesPerChannel)); }
+
+    // holds numNotes notes and re-strikes one of them every restrikeInterval samples
+    void fillMidi(juce::MidiBuffer& midi, int numNotes, juce::int64 blockStart, int numSamples, int restrikeInterval)
+    {
+        midi.clear();
+
+        if (blockStart == 0)
+            for (int note = 0; note < numNotes; ++note)
+                midi.addEvent(noteOn(note), 0);
+
+        const auto firstEvent = (blockStart + restrikeInterval - 1) / restrikeInterval;
+
+        for (auto event = juce::jmax(firstEvent, static_cast<juce::int64>(1)); event * restrikeInterval < blockStart + numSamples; ++event)
+        {
+            const int note = static_cast<int>(event % numNotes);
+            const int offset = static_cast<int>(event * restrikeInterval - blockStart);
+
+            midi.addEvent(noteOff(note), offset);
+            midi.addEvent(noteOn(note), offset);
+        }
+    }
+
+    void setParameter(LiveGranularSynthAudioProcessor& processor, const char* parameterID, float value)
+    {
+        if (auto* param = processor.getValueTreeState().getParameter(parameterID))
+            param->setValueNotifyingHost(param->convertTo0to1(value));
+    }
+
+    void setPrecision(LiveGranularSynthAudioProcessor& processor, bool doublePrecision)
+    {
+        processor.setProcessingPrecision(doublePrecision ? juce::AudioProcessor::doublePrecision
+                                                         : juce::AudioProcessor::singlePrecision);
+    }
+
+    // before prepareToPlay, as a host would; false if the processor turns it down
+    bool setOutputLayout(LiveGranularSynthAudioProcessor& processor, const juce::AudioChannelSet& layout)
+    {
+        auto buses = processor.getBusesLayout();
+        buses.outputBuses.getReference(0) = layout;
+        return processor.setBusesLayout(buses);
+    }
+
+    // room for every input and output channel, as hosts pass to processBlock
+    int getNumBufferChannels(const LiveGranularSynthAudioProcessor& processor)
+    {
+        return juce::jmax(processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+    }
+
+    //==============================================================================
+    // renders totalSamples of the scenario at SampleType, which must match the
+    // processor's precision, timing each processBlock call
+    template <typename SampleType>
+    Timing renderScenario(LiveGranularSynthAudioProcessor& processor, const Scenario& scenario, juce::int64 totalSamples)
+    {
+        juce::AudioBuffer<SampleType> buffer(getNumBufferChannels(processor), scenario.blockSize);
+        juce::MidiBuffer midi;
+        midi.ensureSize(4096);
+        juce::Random random(1);
+
+        const int restrikeInterval = static_cast<int>(0.25 * scenario.sampleRate);
+
+        Timing timing;
+
+        for (juce::int64 position = 0; position < totalSamples; position += scenario.blockSize)
+        {
+            fillInput(buffer, scenario.blockSize, scenario.sampleRate, position, random);
+            fillMidi(midi, scenario.numNotes, position, scenario.blockSize, restrikeInterval);
+
+            const auto start = juce::Time::getHighResolutionTicks();
+            processor.processBlock(buffer, midi);
+            const auto elapsed = juce::Time::getHighResolutionTicks() - start;
+
+            timing.totalTicks += elapsed;
+            timing.worstTicks = juce::jmax(timing.worstTicks, elapsed);
+        }
+
+        return timing;
+    }
+
+    Result runScenario(const Scenario& scenario, double secondsToRender, bool parallel, int interpolation, int storage, int polyphony,
+                       bool powerOfTwo, bool governor, bool doublePrecision, int synthesis, const juce::AudioChannelSet& layout)
+    {
+        LiveGranularSynthAudioProcessor processor;
+        setOutputLayout(processor, layout);
+
+        setParameter(processor, ParameterIDs::polyphony, static_cast<float>(polyphony));
+
+        // before prepareToPlay, so the buffer is allocated in this format from the start
+        setParameter(processor, ParameterIDs::bufferFormat, static_cast<float>(storage));
+        setParameter(processor, ParameterIDs::bufferPowerOfTwo, powerOfTwo ? 1.0f : 0.0f);
+
+        setParameter(processor, ParameterIDs::parallelRendering, parallel ? 1.0f : 0.0f);
+        setParameter(processor, ParameterIDs::interpolation, static_cast<float>(interpolation));
+        setParameter(processor, ParameterIDs::synthesis, static_cast<float>(synthesis));
+        setParameter(processor, ParameterIDs::loadGovernor, governor ? 1.0f : 0.0f);
+
+        setParameter(processor, ParameterIDs::density, scenario.density);
+        setParameter(processor, ParameterIDs::grainSize, scenario.grainSizeMs);
+        setParameter(processor, ParameterIDs::spray, 20.0f);
+        setParameter(processor, ParameterIDs::panSpread, 0.5f);
+
+        // hosts pick the precision before preparing
+        setPrecision(processor, doublePrecision);
+
+        processor.setRateAndBufferSizeDetails(scenario.sampleRate, scenario.blockSize);
+        processor.prepareToPlay(scenario.sampleRate, scenario.blockSize);
+
+        const auto totalSamples = static_cast<juce::int64>(secondsToRender * scenario.sampleRate);
+
+        RealtimeSafety::resetViolations();
+
+        const auto timing = doublePrecision ? renderScenario<double>(processor, scenario, totalSamples)
+                                            : renderScenario<float>(processor, scenario, totalSamples);
+
+        processor.releaseResources();
+
+        const double totalSeconds = juce::Time::highResolutionTicksToSeconds(timing.totalTicks);
+
+        Result result;
+        result.nsPerSample = totalSeconds * 1.0e9 / static_cast<double>(totalSamples);
+        result.realtimePercent = 100.0 * totalSeconds / secondsToRender;
+        result.worstBlockMs = juce::Time::highResolutionTicksToSeconds(timing.worstTicks) * 1000.0;
+        result.budgetMs = 1000.0 * scenario.blockSize / scenario.sampleRate;
+        result.allocations = RealtimeSafety::getNumViolations();
+        return result;
+    }
+
+    void printHeader()
+    {
+        std::printf("%6s %8s %6s %8s %8s %9s %9s %7s | %10s %10s %12s %11s %7s\n",
+                    "block", "rate", "notes", "density", "storage", "precision", "synthesis", "outputs", "ns/sample", "% budget", "worst (ms)", "budget (ms)", "allocs");
+    }
+
+    void printResult(const Scenario& scenario, int storage, bool doublePrecision, int synthesis, int numOutputs, const Result& result)
+    {
+        constexpr std::array<const char*, 3> storageNames { "float", "int16", "half" };
+        constexpr std::array<const char*, 2> synthesisNames { "time", "ola" };
+
+        std::printf("%6d %8.0f %6d %8.0f %8s %9s %9s %7d | %10.1f %10.2f %12.3f %11.3f %7lld\n",
+                    scenario.blockSize, scenario.sampleRate, scenario.numNotes, scenario.density, storageNames[(size_t) storage],
+                    doublePrecision ? "double" : "float", synthesisNames[(size_t) synthesis], numOutputs, result.nsPerSample, result.realtimePercent, result.worstBlockMs, result.budgetMs,
+                    static_cast<long long>(result.allocations));
+    }
+
+    //==============================================================================
+    std::vector<Scenario> createScenarios(bool fullGrid)
+    {
+        std::vector<Scenario> scenarios;
+        const Scenario base;
+
+        if (fullGrid)
+        {
+            for (auto blockSize : blockSizes)
+                for (auto sampleRate : sampleRates)
+                    for (auto numNotes : noteCounts)
+                        for (auto density : densities)
+                            scenarios.push_back({ blockSize, sampleRate, numNotes, density });
+
+            return scenarios;
+        }
+
+        // one axis at a time around the base scenario
+        for (auto blockSize : blockSizes)   { auto s = base; s.blockSize = blockSize;   scenarios.push_back(s); }
+        for (auto sampleRate : sampleRates) { auto s = base; s.sampleRate = sampleRate; scenarios.push_back(s); }
+        for (auto numNotes : noteCounts)    { auto s = base; s.numNotes = numNotes;     scenarios.push_back(s); }
+        for (auto density : densities)      { auto s = base; s.density = density;       scenarios.push_back(s); }
+
+        return scenarios;
+    }
+
+    //==============================================================================
+    // one pass of the realtime check at the processor's precision, which SampleType must match
+    template <typename SampleType>
+    void stressProcessor(LiveGranularSynthAudioProcessor& processor, juce::Random& random)
+    {
+        const int numChannels = getNumBufferChannels(processor);
+
+        juce::AudioBuffer<SampleType> buffer(numChannels, blockSizes.back());
+        juce::MidiBuffer midi;
+        midi.ensureSize(4096);
+
+        for (auto sampleRate : { 44100.0, 192000.0 })
+        {
+            for (auto blockSize : blockSizes)
+            {
+                processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+                processor.prepareToPlay(sampleRate, blockSize);
+
+                for (int block = 0; block < 200; ++block)
+                {
+                    // hosts may deliver anything up to the prepared size
+                    const int numSamples = 1 + random.nextInt(blockSize);
+
+                    juce::AudioBuffer<SampleType> view(buffer.getArrayOfWritePointers(), numChannels, numSamples);
+                    fillInput(view, numSamples, sampleRate, block * blockSize, random);
+
+                    midi.clear();
+
+                    for (int event = 0; event < 8; ++event)
+                    {
+                        const int note = 36 + random.nextInt(48);
+                        const int offset = random.nextInt(numSamples);
+
+                        if (random.nextBool())
+                            midi.addEvent(juce::MidiMessage::noteOn(1, note, 0.8f), offset);
+                        else
+                            midi.addEvent(juce::MidiMessage::noteOff(1, note), offset);
+                    }
+
+                    processor.processBlock(view, midi);
+                }
+
+                processor.releaseResources();
+            }
+        }
+    }
+
+    // Hammers the processor with rapid note-ons/offs (more notes than voices, so voices
+    // get stolen), random sub-block sizes and re-prepares at every block size, counting
+    // any allocation made inside processBlock. Parallel rendering is on, so the voice
+    // workers are checked as well. Runs in float, then again in double, then in float
+    // with Overlap-Add, then into third-order ambisonics, where every grain takes the
+    // multichannel path
+    int runRealtimeCheck()
+    {
+        LiveGranularSynthAudioProcessor processor;
+
+        setParameter(processor, ParameterIDs::density, 1000.0f);
+        setParameter(processor, ParameterIDs::grainSize, 20.0f);
+        setParameter(processor, ParameterIDs::spray, 50.0f);
+        setParameter(processor, ParameterIDs::panSpread, 1.0f);
+        setParameter(processor, ParameterIDs::pitchSpray, 2.0f);
+        setParameter(processor, ParameterIDs::parallelRendering, 1.0f);
+
+        juce::Random random(7);
+
+        RealtimeSafety::resetViolations();
+
+        // switching between passes also checks the idle engine is released and rebuilt cleanly
+        setPrecision(processor, false);
+        stressProcessor<float>(processor, random);
+
+        setPrecision(processor, true);
+        stressProcessor<double>(processor, random);
+
+        // prepareToPlay allocates the engines, as nothing here runs the message loop
+        setParameter(processor, ParameterIDs::synthesis, 1.0f);
+        setPrecision(processor, false);
+        stressProcessor<float>(processor, random);
+
+        // Overlap-Add stays on, so its stereo-only engine has to stand aside cleanly
+        if (! setOutputLayout(processor, juce::AudioChannelSet::ambisonic(3)))
+        {
+            std::printf("realtime check: third-order ambisonic output turned down\n");
+            return 1;
+        }
+
+        stressProcessor<float>(processor, random);
+
+        const auto violations = RealtimeSafety::getNumViolations();
+
+        std::printf("realtime check: %lld allocation(s) inside processBlock\n", static_cast<long long>(violations));
+        return violations == 0 ? 0 : 1;
+    }
+    //==============================================================================
+    // Regression cases: short deterministic renders (seeded voices, governor off) whose
+    // output is compared against stored reference files and whose speed is compared
+    // against a stored baseline, so changes to the read path can't quietly alter the
+    // sound or slow it down
+    enum class Signal
+    {
+        sine,           // fillInput's detuned sines
+        noise,
+        leftNoise,      // noise in the first input channel only, so a lost stereo image shows
+        impulses        // one full-scale sample every impulseInterval
+    };
+
+    struct RegressionCase
+    {
+        const char* name;
+        Signal signal { Signal::sine };
+        std::vector<std::pair<const char*, float>> parameters;
+        int numNotes { 3 };
+        bool doublePrecision { false };
+        const char* layout { "stereo" };    // see SpatialPanner::getLayoutForName
+    };
+
+    struct RegressionResult
+    {
+        juce::AudioBuffer<float> output;
+        double nsPerSample { 0.0 };
+        bool deterministic { true };
+    };
+
+    constexpr double regressionSampleRate { 48000.0 };
+    constexpr int regressionBlockSize { 480 };
+    constexpr double regressionSeconds { 2.0 };
+    constexpr int impulseInterval { 1000 };
+
+    std::vector<RegressionCase> createRegressionCases()
+    {
+        // a fractional pitch, so every kernel actually interpolates
+        const std::pair<const char*, float> detune { ParameterIDs::pitch, 7.3f };
+
+        return {
+            { "default",                 Signal::sine,     {} },
+            { "interpolation-auto",      Signal::noise,    { detune, { ParameterIDs::interpolation, 0.0f } } },
+            { "interpolation-linear",    Signal::noise,    { detune, { ParameterIDs::interpolation, 1.0f } } },
+            { "interpolation-hermite",   Signal::noise,    { detune, { ParameterIDs::interpolation, 2.0f } } },
+            { "interpolation-lagrange",  Signal::noise,    { detune, { ParameterIDs::interpolation, 3.0f } } },
+            { "interpolation-sinc",      Signal::noise,    { detune, { ParameterIDs::interpolation, 4.0f } } },
+            { "window-hann",             Signal::sine,     { { ParameterIDs::window, 0.0f } } },
+            { "window-tukey",            Signal::sine,     { { ParameterIDs::window, 1.0f } } },
+            { "window-gaussian",         Signal::sine,     { { ParameterIDs::window, 2.0f } } },
+            { "window-trapezoid",        Signal::sine,     { { ParameterIDs::window, 3.0f } } },
+            { "window-exp-decay",        Signal::sine,     { { ParameterIDs::window, 4.0f } } },
+
+            // the shortest buffer wraps eight times in a render; grains read right up to
+            // the write head, reach back to the oldest sample, or race the head at 4x
+            { "wrap-oldest",             Signal::impulses, { { ParameterIDs::bufferLength, 0.25f }, { ParameterIDs::position, 1.0f }, { ParameterIDs::spray, 100.0f } } },
+            { "wrap-newest",             Signal::impulses, { { ParameterIDs::bufferLength, 0.25f }, { ParameterIDs::position, 0.0f }, { ParameterIDs::interpolation, 4.0f } } },
+            { "wrap-fast",               Signal::noise,    { { ParameterIDs::bufferLength, 0.25f }, { ParameterIDs::pitch, 24.0f }, { ParameterIDs::interpolation, 3.0f } } },
+            { "wrap-power-of-two",       Signal::noise,    { { ParameterIDs::bufferLength, 0.25f }, { ParameterIDs::bufferPowerOfTwo, 1.0f }, { ParameterIDs::position, 0.9f }, { ParameterIDs::pitch, -12.0f } } },
+            { "format-int16",            Signal::noise,    { { ParameterIDs::bufferLength, 0.25f }, { ParameterIDs::bufferFormat, 1.0f }, detune } },
+            { "format-half",             Signal::noise,    { { ParameterIDs::bufferLength, 0.25f }, { ParameterIDs::bufferFormat, 2.0f }, detune } },
+
+            // more notes than voices, so stealing is covered too
+            { "dense-steal",             Signal::sine,     { { ParameterIDs::density, 1000.0f }, { ParameterIDs::grainSize, 20.0f },
+                                                             { ParameterIDs::panSpread, 1.0f }, { ParameterIDs::polyphony, 4.0f } }, 8 },
+            { "double-precision",        Signal::noise,    { detune, { ParameterIDs::interpolation, 2.0f } }, 3, true },
+
+            // every random offset at once: spray, pan and pitch
+            { "jitter",                  Signal::noise,    { { ParameterIDs::density, 500.0f }, { ParameterIDs::spray, 50.0f },
+                                                             { ParameterIDs::panSpread, 1.0f }, { ParameterIDs::pitchSpray, 2.0f } } },
+
+            // dense enough that playheads carry many grains
+            { "overlap-add",             Signal::noise,    { { ParameterIDs::synthesis, 1.0f }, { ParameterIDs::density, 1000.0f },
+                                                             { ParameterIDs::grainSize, 50.0f }, { ParameterIDs::panSpread, 1.0f } } },
+
+            // grains all the way round: speaker pairs with the LFE left out, the ambisonic
+            // encoding, and a stereo input whose left channel must stay left of centre
+            { "layout-7.1",              Signal::noise,    { { ParameterIDs::density, 500.0f }, { ParameterIDs::panSpread, 1.0f } }, 3, false, "7.1" },
+            { "layout-ambi3",            Signal::noise,    { { ParameterIDs::density, 500.0f }, { ParameterIDs::panSpread, 1.0f } }, 3, false, "ambi3" },
+            { "layout-ambi1-stereo",     Signal::leftNoise, { { ParameterIDs::density, 500.0f } }, 3, false, "ambi1" }
+        };
+    }
+
+    template <typename SampleType>
+    void fillSignal(juce::AudioBuffer<SampleType>& buffer, int numSamples, Signal signal, juce::int64 startSample, juce::Random& random)
+    {
+        if (signal == Signal::sine)
+        {
+            fillInput(buffer, numSamples, regressionSampleRate, startSample, random);
+            return;
+        }
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            auto* data = buffer.getWritePointer(channel);
+
+            if (signal == Signal::leftNoise && channel > 0)
+            {
+                buffer.clear(channel, 0, numSamples);
+                continue;
+            }
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                if (signal == Signal::noise || signal == Signal::leftNoise)
+                    data[i] = static_cast<SampleType>(0.5f * (random.nextFloat() * 2.0f - 1.0f));
+                else
+                    data[i] = static_cast<SampleType>((startSample + i) % impulseInterval == 0 ? 1.0f : 0.0f);
+            }
+        }
+    }
+
+    // renders the case once; the output is kept in float whatever the precision
+    template <typename SampleType>
+    juce::AudioBuffer<float> renderRegressionCase(const RegressionCase& regressionCase, juce::int64& ticks)
+    {
+        LiveGranularSynthAudioProcessor processor;
+
+        setOutputLayout(processor, SpatialPanner::getLayoutForName(regressionCase.layout));
+        setParameter(processor, ParameterIDs::loadGovernor, 0.0f);
+
+        for (const auto& [parameterID, value] : regressionCase.parameters)
+            setParameter(processor, parameterID, value);
+
+        processor.setRandomSeed(1);
+        setPrecision(processor, std::is_same_v<SampleType, double>);
+        processor.setRateAndBufferSizeDetails(regressionSampleRate, regressionBlockSize);
+        processor.prepareToPlay(regressionSampleRate, regressionBlockSize);
+
+        const auto totalSamples = static_cast<int>(regressionSeconds * regressionSampleRate);
+        const int restrikeInterval = static_cast<int>(0.25 * regressionSampleRate);
+
+        const int numOutputChannels = processor.getTotalNumOutputChannels();
+
+        juce::AudioBuffer<SampleType> buffer(getNumBufferChannels(processor), regressionBlockSize);
+        juce::AudioBuffer<float> output(numOutputChannels, totalSamples);
+        juce::MidiBuffer midi;
+        midi.ensureSize(4096);
+        juce::Random random(1);
+
+        ticks = 0;
+
+        for (int position = 0; position < totalSamples; position += regressionBlockSize)
+        {
+            fillSignal(buffer, regressionBlockSize, regressionCase.signal, position, random);
+            fillMidi(midi, regressionCase.numNotes, position, regressionBlockSize, restrikeInterval);
+
+            const auto start = juce::Time::getHighResolutionTicks();
+            processor.processBlock(buffer, midi);
+            ticks += juce::Time::getHighResolutionTicks() - start;
+
+            for (int channel = 0; channel < numOutputChannels; ++channel)
+                for (int i = 0; i < regressionBlockSize; ++i)
+                    output.setSample(channel, position + i, static_cast<float>(buffer.getSample(channel, i)));
+        }
+
+        processor.releaseResources();
+        return output;
+    }
+
+    // the fastest of several runs, which are also checked against each other
+    RegressionResult runRegressionCase(const RegressionCase& regressionCase, int numRuns)
+    {
+        RegressionResult result;
+        juce::int64 fastestTicks = std::numeric_limits<juce::int64>::max();
+
+        for (int run = 0; run < numRuns; ++run)
+        {
+            juce::int64 ticks = 0;
+            auto output = regressionCase.doublePrecision ? renderRegressionCase<double>(regressionCase, ticks)
+                                                         : renderRegressionCase<float>(regressionCase, ticks);
+
+            if (run == 0)
+                result.output = std::move(output);
+            else
+                for (int channel = 0; channel < output.getNumChannels(); ++channel)
+                    if (std::memcmp(output.getReadPointer(channel), result.output.getReadPointer(channel), sizeof(float) * (size_t) output.getNumSamples()) != 0)
+                        result.deterministic = false;
+
+            fastestTicks = juce::jmin(fastestTicks, ticks);
+        }
+
+        result.nsPerSample = juce::Time::highResolutionTicksToSeconds(fastestTicks) * 1.0e9 / (regressionSeconds * regressionSampleRate);
+        return result;
+    }
+
+    //==============================================================================
+    // Overlap-Add against the time domain, on the same seeded case rendered both ways.
+    // Overlap-Add never approximates, so every case must match sample for sample, whether
+    // the engine takes its grains or leaves them to the time domain
+    struct SynthesisComparison
+    {
+        const char* name;
+        std::vector<std::pair<const char*, float>> parameters;
+        float maxError;             // largest sample difference over the time domain's peak; 0 skips it
+        float maxLevelDb;           // RMS level difference, either way
+    };
+
+    struct SynthesisDifference
+    {
+        float error { 0.0f };
+        float levelDb { 0.0f };
+    };
+
+    std::vector<SynthesisComparison> createSynthesisComparisons()
+    {
+        return {
+            { "exact",      { { ParameterIDs::density, 1000.0f }, { ParameterIDs::grainSize, 50.0f }, { ParameterIDs::panSpread, 1.0f } },
+                            1.0e-5f, 0.01f },
+            { "fallback",   { { ParameterIDs::density, 1000.0f }, { ParameterIDs::grainSize, 50.0f }, { ParameterIDs::panSpread, 1.0f },
+                              { ParameterIDs::spray, 5.0f }, { ParameterIDs::pitchSpray, 1.0f } },
+                            1.0e-5f, 0.01f }
+        };
+    }
+
+    SynthesisDifference compareSyntheses(const SynthesisComparison& comparison)
+    {
+        auto parameters = comparison.parameters;
+        parameters.push_back({ ParameterIDs::synthesis, 0.0f });
+        const RegressionCase timeDomainCase { comparison.name, Signal::noise, parameters };
+
+        parameters.back().second = 1.0f;
+        const RegressionCase overlapAddCase { comparison.name, Signal::noise, parameters };
+
+        juce::int64 ticks = 0;
+        const auto timeDomain = renderRegressionCase<float>(timeDomainCase, ticks);
+        const auto overlapAdd = renderRegressionCase<float>(overlapAddCase, ticks);
+
+        double peak = 0.0, largest = 0.0, timeDomainEnergy = 0.0, overlapAddEnergy = 0.0;
+
+        for (int channel = 0; channel < timeDomain.getNumChannels(); ++channel)
+        {
+            for (int i = 0; i < timeDomain.getNumSamples(); ++i)
+            {
+                const double a = timeDomain.getSample(channel, i);
+                const double b = overlapAdd.getSample(channel, i);
+
+                peak = juce::jmax(peak, std::abs(a));
+                largest = juce::jmax(largest, std::abs(a - b));
+                timeDomainEnergy += a * a;
+                overlapAddEnergy += b * b;
+            }
+        }
+
+        SynthesisDifference difference;
+        difference.error = peak > 0.0 ? static_cast<float>(largest / peak) : 0.0f;
+        difference.levelDb = timeDomainEnergy > 0.0 && overlapAddEnergy > 0.0
+                                 ? static_cast<float>(10.0 * std::log10(overlapAddEnergy / timeDomainEnergy))
+                                 : -100.0f;
+        return difference;
+    }
+
+    //==============================================================================
+    bool writeReference(const juce::File& file, const juce::AudioBuffer<float>& output)
+    {
+        file.deleteFile();
+        std::unique_ptr<juce::OutputStream> stream (file.createOutputStream());
+        juce::WavAudioFormat wav;
+
+        if (stream == nullptr)
+            return false;
+
+        // 32-bit float, so the reference holds exactly what was rendered
+        std::unique_ptr<juce::AudioFormatWriter> writer (wav.createWriterFor(stream.get(), regressionSampleRate, static_cast<unsigned int>(output.getNumChannels()), 32, {}, 0));
+
+        if (writer == nullptr)
+            return false;
+
+        stream.release();
+        return writer->writeFromAudioSampleBuffer(output, 0, output.getNumSamples());
+    }
+
+    // largest difference from the reference, or -1 if it's missing or a different shape
+    float compareWithReference(const juce::File& file, const juce::AudioBuffer<float>& output)
+    {
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+
+        std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor(file));
+
+        if (reader == nullptr || reader->lengthInSamples != output.getNumSamples() || static_cast<int>(reader->numChannels) != output.getNumChannels())
+            return -1.0f;
+
+        juce::AudioBuffer<float> reference(output.getNumChannels(), output.getNumSamples());
+        reader->read(&reference, 0, output.getNumSamples(), 0, true, true);
+
+        float largest = 0.0f;
+
+        for (int channel = 0; channel < output.getNumChannels(); ++channel)
+            for (int i = 0; i < output.getNumSamples(); ++i)
+                largest = juce::jmax(largest, std::abs(output.getSample(channel, i) - reference.getSample(channel, i)));
+
+        return largest;
+    }
+
+    std::map<juce::String, double> readBaseline(const juce::File& file)
+    {
+        std::map<juce::String, double> baseline;
+        juce::StringArray lines;
+        file.readLines(lines);
+
+        for (const auto& line : lines)
+        {
+            const auto tokens = juce::StringArray::fromTokens(line, false);
+
+            if (tokens.size() == 2)
+                baseline[tokens[0]] = tokens[1].getDoubleValue();
+        }
+
+        return baseline;
+    }
+
+    //==============================================================================
+    // record: renders every case into directory as the new reference, and its timing
+    // into baselineFile if there is one. check: renders them again and fails on a missing
+    // reference, on output further than tolerance from it, on runs that disagree with
+    // each other, or (only with a baselineFile) on a case more than maxSlowdownPercent
+    // slower than its baseline
+    int runRegression(const juce::File& directory, bool record, float tolerance, const juce::File& baselineFile,
+                      double maxSlowdownPercent, int numRuns)
+    {
+        if (record && ! directory.createDirectory())
+        {
+            std::fprintf(stderr, "can't create %s\n", directory.getFullPathName().toRawUTF8());
+            return 1;
+        }
+
+        const bool timed = baselineFile != juce::File();
+        const auto baseline = timed && ! record ? readBaseline(baselineFile) : std::map<juce::String, double>();
+        juce::String newBaseline;
+        int numFailed = 0;
+        int numMissing = 0;
+
+        std::printf("%-24s | %12s %10s %10s %8s | %s\n", "case", "max diff", "ns/sample", "baseline", "change", "result");
+
+        for (const auto& regressionCase : createRegressionCases())
+        {
+            const auto result = runRegressionCase(regressionCase, numRuns);
+            const auto reference = directory.getChildFile(juce::String(regressionCase.name) + ".wav");
+
+            newBaseline << regressionCase.name << " " << juce::String(result.nsPerSample, 3) << "\n";
+
+            if (record)
+            {
+                const bool written = writeReference(reference, result.output);
+
+                std::printf("%-24s | %12s %10.1f %10s %8s | %s\n", regressionCase.name, "-", result.nsPerSample, "-", "-",
+                            ! written ? "WRITE FAILED" : result.deterministic ? "recorded" : "NONDETERMINISTIC");
+
+                if (! written || ! result.deterministic)
+                    ++numFailed;
+
+                continue;
+            }
+
+            const float difference = compareWithReference(reference, result.output);
+            const auto expected = baseline.find(regressionCase.name);
+            const double change = expected != baseline.end() && expected->second > 0.0 ? 100.0 * (result.nsPerSample / expected->second - 1.0) : 0.0;
+
+            const char* verdict = "ok";
+
+            if (difference < 0.0f)                          verdict = "NO REFERENCE";
+            else if (difference > tolerance)                verdict = "OUTPUT CHANGED";
+            else if (! result.deterministic)                verdict = "NONDETERMINISTIC";
+            else if (timed && expected == baseline.end())   verdict = "NO BASELINE";
+            else if (timed && change > maxSlowdownPercent)  verdict = "SLOWER";
+
+            if (std::strcmp(verdict, "ok") != 0)
+                ++numFailed;
+
+            if (difference < 0.0f)
+                ++numMissing;
+
+            std::printf("%-24s | %12.3g %10.1f %10.1f %7.1f%% | %s\n", regressionCase.name, static_cast<double>(difference), result.nsPerSample,
+                        expected != baseline.end() ? expected->second : 0.0, change, verdict);
+        }
+
+        std::printf("\n%-24s | %12s %10s | %s\n", "overlap-add vs time", "max error", "level (dB)", "result");
+
+        for (const auto& comparison : createSynthesisComparisons())
+        {
+            const auto difference = compareSyntheses(comparison);
+            const bool matches = (comparison.maxError <= 0.0f || difference.error <= comparison.maxError)
+                              && std::abs(difference.levelDb) <= comparison.maxLevelDb;
+
+            if (! matches)
+                ++numFailed;
+
+            std::printf("%-24s | %12.3g %10.2f | %s\n", comparison.name, static_cast<double>(difference.error),
+                        static_cast<double>(difference.levelDb), matches ? "ok" : "DIFFERS FROM TIME DOMAIN");
+        }
+
+        if (record && timed && ! baselineFile.replaceWithText(newBaseline))
+            ++numFailed;
+
+        if (numMissing > 0)
+            std::printf("\n%d reference(s) missing from %s; record them with --regression-record\n", numMissing,
+                        directory.getFullPathName().toRawUTF8());
+
+        std::printf("regression %s: %d failure(s)\n", record ? "record" : "check", numFailed);
+        return numFailed == 0 ? 0 : 1;
+    }
+
+    //==============================================================================
+    // For each grain size, renders the base scenario at rising densities in both
+    // synthesis modes and reports the lowest density at which Overlap-Add is faster
+    int runCrossover(double secondsToRender, bool parallel, int interpolation, int polyphony, bool doublePrecision)
+    {
+        std::printf("%10s %8s | %12s %12s %8s\n", "grain (ms)", "density", "time ns/smp", "ola ns/smp", "speedup");
+
+        for (auto grainSizeMs : crossoverGrainSizes)
+        {
+            float crossover = 0.0f;
+
+            for (auto density : crossoverDensities)
+            {
+                Scenario scenario;
+                scenario.grainSizeMs = grainSizeMs;
+                scenario.density = density;
+
+                const auto timeDomain = runScenario(scenario, secondsToRender, parallel, interpolation, 0, polyphony, false, false, doublePrecision, 0,
+                                                    juce::AudioChannelSet::stereo());
+                const auto overlapAdd = runScenario(scenario, secondsToRender, parallel, interpolation, 0, polyphony, false, false, doublePrecision, 1,
+                                                    juce::AudioChannelSet::stereo());
+                const double speedup = overlapAdd.nsPerSample > 0.0 ? timeDomain.nsPerSample / overlapAdd.nsPerSample : 0.0;
+
+                std::printf("%10.0f %8.0f | %12.1f %12.1f %7.2fx\n", grainSizeMs, density, timeDomain.nsPerSample, overlapAdd.nsPerSample, speedup);
+
+                if (crossover == 0.0f && speedup > 1.0)
+                    crossover = density;
+            }
+
+            if (crossover > 0.0f)
+                std::printf("%.0f ms grains: Overlap-Add is faster from %.0f grains/s\n\n", grainSizeMs, crossover);
+            else
+                std::printf("%.0f ms grains: Overlap-Add is never faster\n\n", grainSizeMs);
+        }
+
+        return 0;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    juce::ArgumentList args (argc, argv);
+
+    if (args.containsOption("--realtime-check"))
+        return runRealtimeCheck();
+
+    if (args.containsOption("--regression-record") || args.containsOption("--regression-check"))
+    {
+        const bool record = args.containsOption("--regression-record");
+        const auto directory = juce::File::getCurrentWorkingDirectory().getChildFile(args.getValueForOption(record ? "--regression-record" : "--regression-check"));
+        const float tolerance = args.containsOption("--tolerance") ? args.getValueForOption("--tolerance").getFloatValue() : 1.0e-4f;
+        const auto baselineFile = args.containsOption("--baseline") ? juce::File::getCurrentWorkingDirectory().getChildFile(args.getValueForOption("--baseline"))
+                                                                    : juce::File();
+        const double maxSlowdown = args.containsOption("--max-slowdown") ? args.getValueForOption("--max-slowdown").getDoubleValue() : 10.0;
+        const int numRuns = args.containsOption("--runs") ? juce::jmax(1, args.getValueForOption("--runs").getIntValue()) : 3;
+
+        return runRegression(directory, record, tolerance, baselineFile, maxSlowdown, numRuns);
+    }
+
+    const double seconds = args.containsOption("--seconds") ? args.getValueForOption("--seconds").getDoubleValue() : 4.0;
+    const bool parallel = args.containsOption("--parallel");
+    const int interpolation = args.containsOption("--interpolation") ? args.getValueForOption("--interpolation").getIntValue() : 0;
+    const int storage = args.containsOption("--storage") ? juce::jlimit(0, 2, args.getValueForOption("--storage").getIntValue()) : 0;
+    const int polyphony = args.containsOption("--polyphony") ? juce::jlimit(1, 512, args.getValueForOption("--polyphony").getIntValue()) : 16;
+    const int numNotes = args.containsOption("--notes") ? juce::jlimit(1, maxNotes, args.getValueForOption("--notes").getIntValue()) : 0;
+    const bool compareStorage = args.containsOption("--compare-storage");
+    const bool powerOfTwo = args.containsOption("--power-of-two");
+    const bool governor = args.containsOption("--governor");
+    const bool comparePrecision = args.containsOption("--compare-precision");
+    const bool doublePrecision = args.containsOption("--double");
+    const bool compareSynthesis = args.containsOption("--compare-synthesis");
+    const bool overlapAdd = args.containsOption("--overlap-add");
+    const auto layout = SpatialPanner::getLayoutForName(args.containsOption("--layout") ? args.getValueForOption("--layout") : "stereo");
+
+    if (layout.isDisabled())
+    {
+        std::fprintf(stderr, "--layout: unknown or unsupported layout\n");
+        return 1;
+    }
+
+    if (args.containsOption("--crossover"))
+        return runCrossover(juce::jmax(0.1, seconds), parallel, juce::jlimit(0, 4, interpolation), polyphony, doublePrecision);
+
+    // 0 is float, 1 is double
+    const int firstPrecision = doublePrecision && ! comparePrecision ? 1 : 0;
+    const int lastPrecision = doublePrecision || comparePrecision ? 1 : 0;
+
+    // 0 is time domain, 1 is Overlap-Add
+    const int firstSynthesis = overlapAdd && ! compareSynthesis ? 1 : 0;
+    const int lastSynthesis = overlapAdd || compareSynthesis ? 1 : 0;
+
+    printHeader();
+
+    for (auto scenario : createScenarios(args.containsOption("--full")))
+    {
+        if (numNotes > 0)
+            scenario.numNotes = numNotes;
+
+        for (int format = compareStorage ? 0 : storage; format <= (compareStorage ? 2 : storage); ++format)
+        {
+            for (int precision = firstPrecision; precision <= lastPrecision; ++precision)
+            {
+                for (int synthesis = firstSynthesis; synthesis <= lastSynthesis; ++synthesis)
+                {
+                    printResult(scenario, format, precision == 1, synthesis, layout.size(),
+                                runScenario(scenario, juce::jmax(0.1, seconds), parallel, juce::jlimit(0, 4, interpolation), format, polyphony,
+                                            powerOfTwo, governor, precision == 1, synthesis, layout));
+                }
+            }
+        }
+    }
+
+    return 0;
+}
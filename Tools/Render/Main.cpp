@@ -0,0 +1,440 @@
+/*
+  ==============================================================================
+
+    Offline renderer.
+
+    Feeds each input file through LiveGranularSynthAudioProcessor as its live
+    input, plays a MIDI file and parameter automation over it, and writes the
+    result as fast as the CPU allows. Inputs (times seeds) are spread over worker
+    threads, each with its own processor instance.
+
+    LiveGranularSynthRender [options] <input> [<input> ...]
+
+    --output <dir>      where renders are written (default: next to each input);
+                        one seed gives <name>-render.wav, more give
+                        <name>-render-<seed>.wav
+    --midi <file>       standard MIDI file to play, all tracks merged (default:
+                        one note held for the length of the input)
+    --automation <file> parameter changes, one per line: <seconds> <parameter id>
+                        <value>, in the parameter's own units; # starts a comment
+    --seeds <n>         render every input with seeds 1 to n (default 1)
+    --seed <n>          first seed (default 1)
+    --jobs <n>          worker threads (default: one per core)
+    --tail <seconds>    rendered past the end of the input (default 2)
+    --block <n>         block size (default 512)
+    --bits <n>          16, 24 or 32 (float) bit output (default 24)
+    --double            process in double precision
+    --layout <name>     output layout: mono, stereo, quad, 5.0, 5.1, 7.0, 7.1,
+                        ambi1 to ambi3 (ACN/SN3D), or a number of speakers in a
+                        ring (default stereo); the output file has its channels
+
+    Automation is applied at block boundaries. Buffer Length, Power-of-2 Buffer
+    and Buffer Format changes are only picked up from automation at 0 seconds,
+    since resizing needs the message thread, which a render doesn't run.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+namespace
+{
+    //==============================================================================
+    struct AutomationPoint
+    {
+        double seconds { 0.0 };
+        juce::String parameterID;
+        float value { 0.0f };
+    };
+
+    struct Settings
+    {
+        juce::File outputDirectory;
+        juce::MidiMessageSequence midi;
+        bool hasMidi { false };
+        std::vector<AutomationPoint> automation;
+        double tailSeconds { 2.0 };
+        int blockSize { 512 };
+        int bitsPerSample { 24 };
+        bool doublePrecision { false };
+        juce::AudioChannelSet outputLayout { juce::AudioChannelSet::stereo() };
+    };
+
+    struct Job
+    {
+        juce::File input;
+        juce::File output;
+        juce::int64 seed { 1 };
+    };
+
+    //==============================================================================
+    bool readMidiFile(const juce::File& file, juce::MidiMessageSequence& sequence)
+    {
+        juce::FileInputStream stream(file);
+        juce::MidiFile midiFile;
+
+        if (! stream.openedOk() || ! midiFile.readFrom(stream))
+            return false;
+
+        midiFile.convertTimestampTicksToSeconds();
+
+        for (int track = 0; track < midiFile.getNumTracks(); ++track)
+            sequence.addSequence(*midiFile.getTrack(track), 0.0);
+
+        sequence.updateMatchedPairs();
+        return true;
+    }
+
+    bool readAutomationFile(const juce::File& file, std::vector<AutomationPoint>& automation)
+    {
+        if (! file.existsAsFile())
+        {
+            std::fprintf(stderr, "%s: not found\n", file.getFullPathName().toRawUTF8());
+            return false;
+        }
+
+        juce::StringArray lines;
+        file.readLines(lines);
+
+        for (auto line : lines)
+        {
+            line = line.upToFirstOccurrenceOf("#", false, false).trim();
+
+            if (line.isEmpty())
+                continue;
+
+            const auto tokens = juce::StringArray::fromTokens(line, false);
+
+            if (tokens.size() != 3)
+            {
+                std::fprintf(stderr, "%s: can't parse \"%s\"\n", file.getFileName().toRawUTF8(), line.toRawUTF8());
+                return false;
+            }
+
+            automation.push_back({ tokens[0].getDoubleValue(), tokens[1], tokens[2].getFloatValue() });
+        }
+
+        // applied in order as the render passes each time
+        std::stable_sort(automation.begin(), automation.end(), [] (const auto& a, const auto& b) { return a.seconds < b.seconds; });
+        return true;
+    }
+
+    juce::File resolve(const juce::String& path)
+    {
+        return juce::File::getCurrentWorkingDirectory().getChildFile(path.unquoted());
+    }
+
+    void setParameter(LiveGranularSynthAudioProcessor& processor, const juce::String& parameterID, float value)
+    {
+        if (auto* param = processor.getValueTreeState().getParameter(parameterID))
+            param->setValueNotifyingHost(param->convertTo0to1(value));
+        else
+            std::fprintf(stderr, "unknown parameter \"%s\"\n", parameterID.toRawUTF8());
+    }
+
+    //==============================================================================
+    // Renders one job on the calling thread. The processor is the worker's own; it is
+    // put back to its default state first, so jobs don't inherit each other's automation
+    template <typename SampleType>
+    bool render(LiveGranularSynthAudioProcessor& processor, const juce::MemoryBlock& defaultState, const Settings& settings, const Job& job)
+    {
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+
+        std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor(job.input));
+
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+        {
+            std::fprintf(stderr, "%s: can't read\n", job.input.getFullPathName().toRawUTF8());
+            return false;
+        }
+
+        const double sampleRate = reader->sampleRate;
+        const auto inputLength = reader->lengthInSamples;
+        const auto totalLength = inputLength + static_cast<juce::int64>(settings.tailSeconds * sampleRate);
+        const int blockSize = settings.blockSize;
+
+        // the whole input up front, so the render loop never waits on the disk
+        juce::AudioBuffer<float> input(static_cast<int>(reader->numChannels), static_cast<int>(inputLength));
+        reader->read(&input, 0, static_cast<int>(inputLength), 0, true, true);
+
+        processor.setStateInformation(defaultState.getData(), static_cast<int>(defaultState.getSize()));
+
+        // nothing to keep up with, so nothing for the governor to drop; jobs already use every core
+        setParameter(processor, ParameterIDs::loadGovernor, 0.0f);
+        setParameter(processor, ParameterIDs::parallelRendering, 0.0f);
+
+        size_t nextPoint = 0;
+
+        // buffer settings are only read by prepareToPlay here, so apply everything at 0 first
+        for (; nextPoint < settings.automation.size() && settings.automation[nextPoint].seconds <= 0.0; ++nextPoint)
+            setParameter(processor, settings.automation[nextPoint].parameterID, settings.automation[nextPoint].value);
+
+        processor.setRandomSeed(job.seed);
+        processor.setNonRealtime(true);
+        processor.setProcessingPrecision(std::is_same_v<SampleType, double> ? juce::AudioProcessor::doublePrecision
+                                                                              : juce::AudioProcessor::singlePrecision);
+        processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+
+        const int numChannels = juce::jmax(processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+        const int numOutputChannels = processor.getTotalNumOutputChannels();
+
+        juce::AudioBuffer<SampleType> block(numChannels, blockSize);
+        juce::AudioBuffer<float> output(numOutputChannels, static_cast<int>(totalLength));
+        juce::MidiBuffer midi;
+
+        // without a MIDI file, one note sounds for as long as there is input
+        juce::MidiMessageSequence heldNote;
+
+        if (! settings.hasMidi)
+        {
+            heldNote.addEvent(juce::MidiMessage::noteOn(1, 60, 0.8f), 0.0);
+            heldNote.addEvent(juce::MidiMessage::noteOff(1, 60), static_cast<double>(inputLength) / sampleRate);
+        }
+
+        const auto& sequence = settings.hasMidi ? settings.midi : heldNote;
+        int nextEvent = 0;
+
+        const auto startTicks = juce::Time::getHighResolutionTicks();
+
+        for (juce::int64 position = 0; position < totalLength; position += blockSize)
+        {
+            const int numSamples = static_cast<int>(juce::jmin(static_cast<juce::int64>(blockSize), totalLength - position));
+            const double blockEndSeconds = static_cast<double>(position + numSamples) / sampleRate;
+
+            for (; nextPoint < settings.automation.size() && settings.automation[nextPoint].seconds * sampleRate <= static_cast<double>(position); ++nextPoint)
+                setParameter(processor, settings.automation[nextPoint].parameterID, settings.automation[nextPoint].value);
+
+            juce::AudioBuffer<SampleType> view(block.getArrayOfWritePointers(), numChannels, numSamples);
+            view.clear();
+
+            // mono input feeds both input channels
+            for (int channel = 0; channel < processor.getTotalNumInputChannels(); ++channel)
+            {
+                const int available = static_cast<int>(juce::jlimit(static_cast<juce::int64>(0), static_cast<juce::int64>(numSamples), inputLength - position));
+                const auto* source = input.getReadPointer(juce::jmin(channel, input.getNumChannels() - 1));
+                auto* destination = view.getWritePointer(channel);
+
+                for (int i = 0; i < available; ++i)
+                    destination[i] = static_cast<SampleType>(source[position + i]);
+            }
+
+            midi.clear();
+
+            for (; nextEvent < sequence.getNumEvents(); ++nextEvent)
+            {
+                const auto& message = sequence.getEventPointer(nextEvent)->message;
+
+                if (message.getTimeStamp() >= blockEndSeconds)
+                    break;
+
+                const auto offset = static_cast<juce::int64>(std::llround(message.getTimeStamp() * sampleRate)) - position;
+                midi.addEvent(message, static_cast<int>(juce::jlimit(static_cast<juce::int64>(0), static_cast<juce::int64>(numSamples - 1), offset)));
+            }
+
+            processor.processBlock(view, midi);
+
+            for (int channel = 0; channel < numOutputChannels; ++channel)
+            {
+                const auto* source = view.getReadPointer(channel);
+                auto* destination = output.getWritePointer(channel, static_cast<int>(position));
+
+                for (int i = 0; i < numSamples; ++i)
+                    destination[i] = static_cast<float>(source[i]);
+            }
+        }
+
+        const double renderSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+
+        processor.releaseResources();
+
+        job.output.deleteFile();
+        std::unique_ptr<juce::OutputStream> stream (job.output.createOutputStream());
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatWriter> writer;
+
+        if (stream != nullptr)
+            writer.reset(wav.createWriterFor(stream.get(), sampleRate, static_cast<unsigned int>(numOutputChannels), settings.bitsPerSample, {}, 0));
+
+        if (writer == nullptr)
+        {
+            std::fprintf(stderr, "%s: can't write\n", job.output.getFullPathName().toRawUTF8());
+            return false;
+        }
+
+        // the writer owns the stream from here
+        stream.release();
+
+        if (! writer->writeFromAudioSampleBuffer(output, 0, output.getNumSamples()))
+        {
+            std::fprintf(stderr, "%s: write failed\n", job.output.getFullPathName().toRawUTF8());
+            return false;
+        }
+
+        const double audioSeconds = static_cast<double>(totalLength) / sampleRate;
+
+        std::printf("%s -> %s: %.1f s in %.2f s (%.0fx realtime)\n",
+                    job.input.getFileName().toRawUTF8(), job.output.getFileName().toRawUTF8(),
+                    audioSeconds, renderSeconds, audioSeconds / juce::jmax(renderSeconds, 1.0e-9));
+        return true;
+    }
+
+    //==============================================================================
+    std::vector<Job> createJobs(const juce::Array<juce::File>& inputs, const juce::File& outputDirectory, juce::int64 firstSeed, int numSeeds)
+    {
+        std::vector<Job> jobs;
+
+        for (const auto& input : inputs)
+        {
+            const auto directory = outputDirectory == juce::File() ? input.getParentDirectory() : outputDirectory;
+
+            for (int i = 0; i < numSeeds; ++i)
+            {
+                const auto seed = firstSeed + i;
+                const auto name = input.getFileNameWithoutExtension() + "-render" + (numSeeds > 1 ? "-" + juce::String(seed) : juce::String()) + ".wav";
+
+                jobs.push_back({ input, directory.getChildFile(name), seed });
+            }
+        }
+
+        return jobs;
+    }
+
+    // Each worker builds one processor and takes jobs off a shared counter until none
+    // are left, so long and short inputs even out across the workers
+    int runJobs(const std::vector<Job>& jobs, const Settings& settings, int numWorkers)
+    {
+        std::atomic<size_t> nextJob { 0 };
+        std::atomic<int> numFailed { 0 };
+
+        auto work = [&]
+        {
+            LiveGranularSynthAudioProcessor processor;
+
+            // main() has already checked the processor takes it
+            auto buses = processor.getBusesLayout();
+            buses.outputBuses.getReference(0) = settings.outputLayout;
+            processor.setBusesLayout(buses);
+
+            juce::MemoryBlock defaultState;
+            processor.getStateInformation(defaultState);
+
+            for (auto index = nextJob.fetch_add(1); index < jobs.size(); index = nextJob.fetch_add(1))
+            {
+                const bool succeeded = settings.doublePrecision ? render<double>(processor, defaultState, settings, jobs[index])
+                                                                : render<float>(processor, defaultState, settings, jobs[index]);
+
+                if (! succeeded)
+                    ++numFailed;
+            }
+        };
+
+        std::vector<std::thread> workers;
+
+        for (int i = 0; i < numWorkers; ++i)
+            workers.emplace_back(work);
+
+        for (auto& worker : workers)
+            worker.join();
+
+        return numFailed.load();
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    juce::ArgumentList args (argc, argv);
+
+    Settings settings;
+    settings.tailSeconds = args.containsOption("--tail") ? juce::jmax(0.0, args.getValueForOption("--tail").getDoubleValue()) : 2.0;
+    settings.blockSize = args.containsOption("--block") ? juce::jlimit(16, 8192, args.getValueForOption("--block").getIntValue()) : 512;
+    settings.bitsPerSample = args.containsOption("--bits") ? args.getValueForOption("--bits").getIntValue() : 24;
+    settings.doublePrecision = args.containsOption("--double");
+
+    if (args.containsOption("--layout"))
+    {
+        settings.outputLayout = SpatialPanner::getLayoutForName(args.getValueForOption("--layout"));
+
+        if (settings.outputLayout.isDisabled())
+        {
+            std::fprintf(stderr, "--layout: unknown or unsupported layout\n");
+            return 1;
+        }
+    }
+
+    if (settings.bitsPerSample != 16 && settings.bitsPerSample != 24 && settings.bitsPerSample != 32)
+    {
+        std::fprintf(stderr, "--bits must be 16, 24 or 32\n");
+        return 1;
+    }
+
+    if (args.containsOption("--output"))
+    {
+        settings.outputDirectory = resolve(args.getValueForOption("--output"));
+
+        if (! settings.outputDirectory.isDirectory())
+        {
+            std::fprintf(stderr, "%s: not a directory\n", settings.outputDirectory.getFullPathName().toRawUTF8());
+            return 1;
+        }
+    }
+
+    if (args.containsOption("--midi"))
+    {
+        const auto file = resolve(args.getValueForOption("--midi"));
+
+        if (! readMidiFile(file, settings.midi))
+        {
+            std::fprintf(stderr, "%s: not a MIDI file\n", file.getFullPathName().toRawUTF8());
+            return 1;
+        }
+
+        settings.hasMidi = true;
+    }
+
+    if (args.containsOption("--automation") && ! readAutomationFile(resolve(args.getValueForOption("--automation")), settings.automation))
+        return 1;
+
+    // everything that isn't an option (or an option's value) is an input
+    const juce::StringArray optionsWithValues { "--output", "--midi", "--automation", "--seeds", "--seed", "--jobs", "--tail", "--block", "--bits", "--layout" };
+    juce::Array<juce::File> inputs;
+
+    for (int i = 0; i < args.size(); ++i)
+    {
+        if (args[i].isOption())
+        {
+            if (optionsWithValues.contains(args[i].text))
+                ++i;
+
+            continue;
+        }
+
+        inputs.add(args[i].resolveAsFile());
+    }
+
+    if (inputs.isEmpty())
+    {
+        std::fprintf(stderr, "usage: LiveGranularSynthRender [options] <input> [<input> ...]\n");
+        return 1;
+    }
+
+    const int numSeeds = args.containsOption("--seeds") ? juce::jmax(1, args.getValueForOption("--seeds").getIntValue()) : 1;
+    const auto firstSeed = args.containsOption("--seed") ? args.getValueForOption("--seed").getLargeIntValue() : 1;
+    const auto jobs = createJobs(inputs, settings.outputDirectory, firstSeed, numSeeds);
+
+    const int numWorkers = juce::jlimit(1, static_cast<int>(jobs.size()),
+                                        args.containsOption("--jobs") ? args.getValueForOption("--jobs").getIntValue()
+                                                                      : juce::SystemStats::getNumCpus());
+
+    const auto startTicks = juce::Time::getHighResolutionTicks();
+    const int numFailed = runJobs(jobs, settings, numWorkers);
+
+    std::printf("%d render(s) on %d worker(s) in %.2f s, %d failed\n", static_cast<int>(jobs.size()), numWorkers,
+                juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks), numFailed);
+
+    return numFailed == 0 ? 0 : 1;
+}